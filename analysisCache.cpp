@@ -0,0 +1,220 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "lib/error.h"
+#include "lib/path.h"
+
+#include "analysisCache.h"
+
+namespace multip4 {
+
+  // Bump when the entry layout or the meaning of an analysis output changes.
+  static const char *CacheFormat = "multip4-cache 7";
+
+  AnalysisCache::AnalysisCache(const Options &options) : options(options) {
+    if (options.noCache)
+      return;
+    if (options.cacheDir != nullptr) {
+      dir = options.cacheDir;
+    } else {
+      const char *env = getenv("MULTIP4_CACHE_DIR");
+      if (env != nullptr && *env != '\0')
+        dir = env;
+    }
+  }
+
+  ContentHash AnalysisCache::key(const std::string &source) const {
+    ContentHash hash;
+    hash.add(cstring(CacheFormat)).add(options.compilerVersion);
+    hash.add(options.file).add(options.preprocessor_options);
+    hash.add((uint64_t)options.isv1());
+    //Options that change what is written, not just how fast
+    hash.add((uint64_t)options.dedupEdges).add(options.graphEdges);
+    hash.add((uint64_t)options.firstApplyOnly);
+    hash.add((uint64_t)(options.pairMatrixDir != nullptr));
+    hash.add((uint64_t)(options.graphDir != nullptr));
+    hash.add((uint64_t)(options.analysisDir != nullptr));
+    hash.add(options.resultsFile == nullptr ? cstring(nullptr) : options.resultsFormat);
+    hash.add(options.resultsFile == nullptr ? cstring(nullptr) : options.resultsDetail);
+    hash.add((uint64_t)(options.resultsFile == "-"));
+    hash.add((uint64_t)options.packStages).add((uint64_t)options.matchGap);
+    hash.add((uint64_t)options.actionGap).add((uint64_t)options.stageTables);
+    hash.add(options.stageMemory);
+    hash.add(source);
+    return hash;
+  }
+
+  cstring AnalysisCache::entryPath(const ContentHash &key) const {
+    return dir + "/" + key.hex();
+  }
+
+  cstring AnalysisCache::outputDir(const std::string &name) const {
+    cstring n = name;
+    if (n.endsWith(".csv"))
+      return options.pairMatrixDir;
+    if (n.endsWith(".dot"))
+      return options.graphDir;
+    if (n.endsWith(".mp4g"))
+      return options.analysisDir;
+    return nullptr;
+  }
+
+  // An entry is the format line followed by sections, each a header line
+  // "<tag> <size> [<name>]" and then size bytes. Tags: out, records, file,
+  // metrics, end.
+  static bool readSection(std::istream &in, std::string &tag, std::string &name,
+      std::string &data) {
+    std::string header;
+    if (!std::getline(in, header))
+      return false;
+    std::istringstream fields(header);
+    size_t size;
+    if (!(fields >> tag >> size))
+      return false;
+    name.clear();
+    std::getline(fields >> std::ws, name);
+    data.resize(size);
+    return size == 0 || (bool)in.read(&data[0], size);
+  }
+
+  static void writeSection(std::ostream &out, const char *tag, const std::string &data,
+      const std::string &name = "") {
+    out << tag << " " << data.size();
+    if (!name.empty())
+      out << " " << name;
+    out << "\n";
+    out.write(data.data(), data.size());
+  }
+
+  // The metrics section holds a "control <name>" line per control, each
+  // followed by "<counter> <value>" lines.
+  static std::string controlCounters(const Metrics &metrics) {
+    std::ostringstream text;
+    for (auto &control : metrics.allControls()) {
+      text << "control " << control->getName() << "\n";
+      for (auto &c : control->allCounters())
+        text << c.first << " " << c.second << "\n";
+    }
+    return text.str();
+  }
+
+  static bool parseControlCounters(const std::string &text,
+      std::vector<std::pair<std::string, std::vector<std::pair<std::string, uint64_t>>>> &out) {
+    std::istringstream in(text);
+    std::string word;
+    uint64_t value;
+    while (in >> word) {
+      if (word == "control") {
+        out.emplace_back();
+        if (!(in >> out.back().first))
+          return false;
+      } else if (out.empty() || !(in >> value)) {
+        return false;
+      } else {
+        out.back().second.emplace_back(word, value);
+      }
+    }
+    return true;
+  }
+
+  bool AnalysisCache::replay(const ContentHash &key, std::ostream &out,
+      ResultWriter *results, Metrics *metrics) const {
+    std::ifstream in(entryPath(key), std::ios::binary);
+    std::string format;
+    if (!in || !std::getline(in, format) || format != CacheFormat)
+      return false;
+
+    //Read the whole entry before writing anything, so that a damaged entry
+    //leaves no partial output
+    std::string outText, records, metricsText, tag, name, data;
+    std::vector<std::pair<std::string, std::string>> files;
+    std::vector<std::pair<std::string, std::vector<std::pair<std::string, uint64_t>>>> controls;
+    bool complete = false;
+    while (readSection(in, tag, name, data)) {
+      if (tag == "out")
+        outText = data;
+      else if (tag == "records")
+        records = data;
+      else if (tag == "file" && !name.empty())
+        files.emplace_back(name, data);
+      else if (tag == "metrics")
+        metricsText = data;
+      else if (tag == "end")
+        complete = true;
+      else
+        return false;
+    }
+    if (!complete || !parseControlCounters(metricsText, controls))
+      return false;
+    for (auto &f : files) {
+      if (outputDir(f.first) == nullptr)
+        return false;
+    }
+
+    out << outText;
+    if (results != nullptr) {
+      std::istringstream recordsIn(records);
+      results->append(recordsIn);
+    }
+    for (auto &f : files) {
+      auto path = outputDir(f.first) + "/" + f.first.c_str();
+      std::ofstream file(path, std::ios::binary);
+      if (!file.write(f.second.data(), f.second.size()))
+        ::error("Failed to write %1%", path);
+    }
+    if (metrics != nullptr) {
+      for (auto &control : controls) {
+        auto m = metrics->addControl(control.first);
+        for (auto &c : control.second)
+          m->set(c.first, c.second);
+      }
+    }
+    return true;
+  }
+
+  void AnalysisCache::store(const ContentHash &key, const std::string &out,
+      const std::string &records, const std::vector<cstring> &files,
+      const Metrics &metrics) const {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+      ::warning("cannot create cache directory %1%", dir);
+      return;
+    }
+    //Write to a private name and rename, so concurrent workers never see a
+    //half-written entry
+    auto path = entryPath(key);
+    auto tmp = path + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream entry(tmp, std::ios::binary);
+      entry << CacheFormat << "\n";
+      writeSection(entry, "out", out);
+      writeSection(entry, "records", records);
+      for (auto f : files) {
+        std::ifstream in(f, std::ios::binary);
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        writeSection(entry, "file", contents.str(),
+            Util::PathName(f).getFilename().c_str());
+      }
+      writeSection(entry, "metrics", controlCounters(metrics));
+      writeSection(entry, "end", "");
+      if (!entry) {
+        entry.close();
+        unlink(tmp);
+        ::warning("cannot write cache entry %1%", path);
+        return;
+      }
+    }
+    if (rename(tmp, path) != 0)
+      unlink(tmp);
+  }
+
+} //namespace multip4
@@ -0,0 +1,55 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_ANALYSIS_CACHE_H
+#define MULTIP4_ANALYSIS_CACHE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "contentHash.h"
+#include "instrumentation.h"
+#include "multip4Options.h"
+#include "resultWriter.h"
+
+namespace multip4 {
+
+  // On-disk cache of the outputs of analyzeFile: the Stat lines, the
+  // --results records, the files written to --pair-matrix, --graph-dir and
+  // --analysis-dir, and the counters of every control's metrics (their
+  // times describe the run that made the entry and are not kept). Entries
+  // are keyed on the preprocessed source (which already contains every
+  // included file), the preprocessor options, the input path, the analyzer
+  // version and every option that changes the outputs. Any change to one of
+  // those selects another entry; entries that cannot be read are treated as
+  // misses and overwritten.
+  class AnalysisCache {
+    public:
+      // The directory comes from --cache-dir, else from $MULTIP4_CACHE_DIR.
+      // --no-cache disables the cache.
+      explicit AnalysisCache(const Options &options);
+
+      bool enabled() const { return dir != nullptr; }
+      ContentHash key(const std::string &source) const;
+
+      // Writes the outputs stored under key, and adds the stored controls
+      // to metrics if given; returns false on a miss.
+      bool replay(const ContentHash &key, std::ostream &out, ResultWriter *results,
+          Metrics *metrics) const;
+      // files: paths of the output files, which are read back from disk.
+      void store(const ContentHash &key, const std::string &out, const std::string &records,
+          const std::vector<cstring> &files, const Metrics &metrics) const;
+
+    private:
+      cstring entryPath(const ContentHash &key) const;
+      cstring outputDir(const std::string &name) const;
+
+      const Options &options;
+      cstring dir = nullptr;
+  };
+
+} //namespace multip4
+
+#endif
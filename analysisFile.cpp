@@ -0,0 +1,261 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "analysisFile.h"
+
+namespace multip4 {
+
+  static bool fail(std::string *error, const std::string &reason) {
+    if (error != nullptr)
+      *error = reason;
+    return false;
+  }
+
+  static bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / size;
+  }
+
+  bool MappedAnalysis::open(const char *path, std::string *error) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return fail(error, std::string(path) + ": " + strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Mp4gHeader)) {
+      ::close(fd);
+      return fail(error, std::string(path) + ": not an .mp4g file");
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return fail(error, std::string(path) + ": " + strerror(errno));
+    data = static_cast<const char*>(p);
+    size = st.st_size;
+
+    auto h = header();
+    std::string reason;
+    if (memcmp(h->magic, Mp4gMagic, sizeof(Mp4gMagic)) != 0)
+      reason = "not an .mp4g file";
+    else if (h->byteOrder != Mp4gByteOrder)
+      reason = ".mp4g file of a different byte order";
+    else if (h->version != Mp4gVersion)
+      reason = "unsupported .mp4g version " + std::to_string(h->version);
+    else if (h->fileSize != size)
+      reason = "truncated .mp4g file";
+    else if (!fits(h->stringsOffset, (uint64_t)h->numStrings + 1, sizeof(uint32_t), size) ||
+        !fits(h->verticesOffset, h->numVertices, sizeof(Mp4gVertex), size) ||
+        !fits(h->tablesOffset, h->numTables, sizeof(Mp4gTable), size) ||
+        !fits(h->actionsOffset, h->numActions, sizeof(Mp4gAction), size) ||
+        !fits(h->fieldsOffset, h->numFields, sizeof(uint32_t), size) ||
+        !fits(h->dependenciesOffset, h->numDependencies, sizeof(Mp4gDependency), size) ||
+        !fits(h->setsOffset, ((uint64_t)h->numTables + 2 * (uint64_t)h->numActions) * h->setWords,
+          sizeof(uint64_t), size) ||
+        !fits(h->reachOffset, 2 * (uint64_t)h->numTables * h->reachWords, sizeof(uint64_t),
+          size) ||
+        !fits(h->branchesOffset, (uint64_t)h->numTables + 1, sizeof(uint32_t), size))
+      reason = "corrupt .mp4g section table";
+    else if ((uint64_t)h->setWords * 64 < h->numFields ||
+        (uint64_t)h->reachWords * 64 < h->numTables)
+      reason = "corrupt .mp4g set width";
+    else if (!validStrings())
+      reason = "corrupt .mp4g string section";
+    else if (!validIndices())
+      reason = "corrupt .mp4g index";
+    else if (!validBranches())
+      reason = "corrupt .mp4g branch section";
+    if (!reason.empty()) {
+      close();
+      return fail(error, std::string(path) + ": " + reason);
+    }
+    return true;
+  }
+
+  void MappedAnalysis::close() {
+    if (data != nullptr)
+      munmap(const_cast<char*>(data), size);
+    data = nullptr;
+    size = 0;
+  }
+
+  const char* MappedAnalysis::string(uint32_t index) const {
+    auto offsets = section<uint32_t>(header()->stringsOffset);
+    return data + header()->stringsOffset + offsets[index];
+  }
+
+  int MappedAnalysis::findTable(const char *name) const {
+    for (uint32_t t = 0; t < numTables(); t++) {
+      if (strcmp(tableName(t), name) == 0)
+        return t;
+    }
+    return -1;
+  }
+
+  bool MappedAnalysis::setContains(uint32_t set, uint32_t field) const {
+    if (field >= header()->numFields)
+      return false;
+    auto words = section<uint64_t>(header()->setsOffset) + (uint64_t)set * header()->setWords;
+    return (words[field / 64] >> (field % 64)) & 1;
+  }
+
+  bool MappedAnalysis::keyUses(uint32_t table, uint32_t field) const {
+    return setContains(tables()[table].keys, field);
+  }
+
+  const char* MappedAnalysis::actionName(uint32_t table, uint32_t action) const {
+    auto actions = section<Mp4gAction>(header()->actionsOffset);
+    return string(actions[tables()[table].firstAction + action].name);
+  }
+
+  bool MappedAnalysis::actionDefines(uint32_t table, uint32_t action, uint32_t field) const {
+    auto actions = section<Mp4gAction>(header()->actionsOffset);
+    return setContains(actions[tables()[table].firstAction + action].def, field);
+  }
+
+  bool MappedAnalysis::actionUses(uint32_t table, uint32_t action, uint32_t field) const {
+    auto actions = section<Mp4gAction>(header()->actionsOffset);
+    return setContains(actions[tables()[table].firstAction + action].use, field);
+  }
+
+  const uint64_t* MappedAnalysis::actionFingerprint(uint32_t table, uint32_t action) const {
+    auto actions = section<Mp4gAction>(header()->actionsOffset);
+    return actions[tables()[table].firstAction + action].fingerprint;
+  }
+
+  const char* MappedAnalysis::fieldName(uint32_t field) const {
+    return string(section<uint32_t>(header()->fieldsOffset)[field]);
+  }
+
+  const char* MappedAnalysis::vertexName(uint32_t vertex) const {
+    return string(section<Mp4gVertex>(header()->verticesOffset)[vertex].name);
+  }
+
+  uint32_t MappedAnalysis::vertexType(uint32_t vertex) const {
+    return section<Mp4gVertex>(header()->verticesOffset)[vertex].type;
+  }
+
+  const Mp4gDependency& MappedAnalysis::dependency(uint32_t i) const {
+    return section<Mp4gDependency>(header()->dependenciesOffset)[i];
+  }
+
+  bool MappedAnalysis::reaches(bool tableOnly, uint32_t from, uint32_t to) const {
+    auto h = header();
+    auto rows = section<uint64_t>(h->reachOffset);
+    if (tableOnly)
+      rows += (uint64_t)h->numTables * h->reachWords;
+    return (rows[(uint64_t)from * h->reachWords + to / 64] >> (to % 64)) & 1;
+  }
+
+  bool MappedAnalysis::isTableIndependent(uint32_t t1, uint32_t t2) const {
+    return !reaches(false, t1, t2) && !reaches(false, t2, t1);
+  }
+
+  bool MappedAnalysis::isActionIndependent(uint32_t t1, uint32_t t2) const {
+    return !reaches(true, t1, t2) && !reaches(true, t2, t1);
+  }
+
+  //Every offset must point into the text, and the text must end in a NUL,
+  //so each string is terminated inside the file
+  bool MappedAnalysis::validStrings() const {
+    auto h = header();
+    auto offsets = section<uint32_t>(h->stringsOffset);
+    uint64_t end = offsets[h->numStrings];
+    uint64_t start = ((uint64_t)h->numStrings + 1) * sizeof(uint32_t);
+    if (end > size - h->stringsOffset || (h->numStrings > 0 && end <= start))
+      return false;
+    if (h->numStrings > 0 && data[h->stringsOffset + end - 1] != '\0')
+      return false;
+    for (uint32_t i = 0; i < h->numStrings; i++) {
+      if (offsets[i] < start || offsets[i] >= end)
+        return false;
+    }
+    return true;
+  }
+
+  //Walks the tables, actions, vertices, fields and dependencies once, so
+  //that no accessor can index past its section
+  bool MappedAnalysis::validIndices() const {
+    auto h = header();
+    uint64_t numSets = (uint64_t)h->numTables + 2 * (uint64_t)h->numActions;
+    if (h->fileName >= h->numStrings || h->controlName >= h->numStrings)
+      return false;
+    auto vertices = section<Mp4gVertex>(h->verticesOffset);
+    for (uint32_t v = 0; v < h->numVertices; v++) {
+      if (vertices[v].name >= h->numStrings)
+        return false;
+    }
+    auto tables = this->tables();
+    for (uint32_t t = 0; t < h->numTables; t++) {
+      auto &table = tables[t];
+      if (table.name >= h->numStrings || table.vertex >= h->numVertices ||
+          table.keys >= numSets ||
+          (uint64_t)table.firstAction + table.numActions > h->numActions)
+        return false;
+    }
+    auto actions = section<Mp4gAction>(h->actionsOffset);
+    for (uint32_t a = 0; a < h->numActions; a++) {
+      if (actions[a].name >= h->numStrings || actions[a].def >= numSets ||
+          actions[a].use >= numSets)
+        return false;
+    }
+    auto fields = section<uint32_t>(h->fieldsOffset);
+    for (uint32_t f = 0; f < h->numFields; f++) {
+      if (fields[f] >= h->numStrings)
+        return false;
+    }
+    auto edges = section<Mp4gDependency>(h->dependenciesOffset);
+    for (uint32_t i = 0; i < h->numDependencies; i++) {
+      if (edges[i].from >= h->numVertices || edges[i].to >= h->numVertices ||
+          edges[i].field >= h->numFields)
+        return false;
+    }
+    return true;
+  }
+
+  bool MappedAnalysis::validBranches() const {
+    auto h = header();
+    auto index = section<uint32_t>(h->branchesOffset);
+    for (uint32_t t = 0; t < h->numTables; t++) {
+      if (index[t] > index[t + 1])
+        return false;
+    }
+    return fits(h->branchesOffset + ((uint64_t)h->numTables + 1) * sizeof(uint32_t),
+        2 * (uint64_t)index[h->numTables], sizeof(uint32_t), size);
+  }
+
+  uint32_t MappedAnalysis::numBranches(uint32_t table) const {
+    auto index = section<uint32_t>(header()->branchesOffset);
+    return index[table + 1] - index[table];
+  }
+
+  void MappedAnalysis::branch(uint32_t table, uint32_t i, uint32_t &id, uint32_t &arm) const {
+    auto index = section<uint32_t>(header()->branchesOffset);
+    auto pairs = index + header()->numTables + 1;
+    id = pairs[2 * (index[table] + i)];
+    arm = pairs[2 * (index[table] + i) + 1];
+  }
+
+  bool MappedAnalysis::isExclusive(uint32_t t1, uint32_t t2) const {
+    uint32_t n = std::min(numBranches(t1), numBranches(t2));
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t id1, arm1, id2, arm2;
+      branch(t1, i, id1, arm1);
+      branch(t2, i, id2, arm2);
+      if (id1 != id2)
+        return false;
+      if (arm1 != arm2)
+        return true;
+    }
+    return false;
+  }
+
+} //namespace multip4
@@ -0,0 +1,176 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_ANALYSIS_FILE_H
+#define MULTIP4_ANALYSIS_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The .mp4g format: the analysis of one control, laid out so that a reader
+// can map the file and use it in place. All integers are in the native byte
+// order of the writer, which the header records, and every section starts
+// at a multiple of 8 bytes.
+//
+//   Mp4gHeader
+//   strings   uint32 offset per string (+1 end offset), then NUL-terminated text
+//   vertices  Mp4gVertex per graph vertex
+//   tables    Mp4gTable per table (conditions excluded), in pair order
+//   actions   Mp4gAction, grouped by table
+//   fields    uint32 string index per interned field
+//   edges     Mp4gDependency per dependency
+//   sets      setWords uint64 words per field set (keys, def, use)
+//   reach     two table x table bit matrices of reachWords words per row:
+//             any path, then paths of TABLE dependencies only
+//   branches  uint32 index per table (+1 end index) into the uint32
+//             (branch, arm) pairs that follow: the if and switch arms the
+//             table is nested in, outermost first
+//
+// The control and every action carry a 128-bit fingerprint of their IR,
+// which incremental analysis compares against the program being analyzed.
+// Only files whose version matches Mp4gVersion and whose byte order
+// matches the reader's are read.
+
+namespace multip4 {
+
+  static const char Mp4gMagic[4] = {'M', 'P', '4', 'G'};
+  static const uint32_t Mp4gVersion = 6;
+  // Written as a native uint32; a reader of the other byte order sees it
+  // reversed
+  static const uint32_t Mp4gByteOrder = 0x01020304;
+
+  struct Mp4gHeader {
+    char magic[4];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t numStrings;
+    uint32_t numVertices;
+    uint32_t numTables;
+    uint32_t numActions;
+    uint32_t numFields;
+    uint32_t numDependencies;
+    uint32_t setWords;
+    uint32_t reachWords;
+    uint32_t fileName;
+    uint32_t controlName;
+    uint32_t reserved;    // zero; keeps the offsets 8-byte aligned
+    uint64_t stringsOffset;
+    uint64_t verticesOffset;
+    uint64_t tablesOffset;
+    uint64_t actionsOffset;
+    uint64_t fieldsOffset;
+    uint64_t dependenciesOffset;
+    uint64_t setsOffset;
+    uint64_t reachOffset;
+    uint64_t fileSize;
+    uint64_t fingerprint[2];
+    uint64_t branchesOffset;
+  };
+
+  struct Mp4gVertex {
+    uint32_t name;
+    uint32_t type;    // Graphs::VertexType
+  };
+
+  struct Mp4gTable {
+    uint32_t name;
+    uint32_t vertex;
+    uint32_t keys;    // set index
+    uint32_t firstAction;
+    uint32_t numActions;
+    uint32_t memory;  // estimated match memory in bytes, saturated
+  };
+
+  struct Mp4gAction {
+    uint32_t name;
+    uint32_t def;     // set index
+    uint32_t use;     // set index
+    uint32_t reserved;
+    uint64_t fingerprint[2];
+  };
+
+  struct Mp4gDependency {
+    uint32_t from;    // vertex
+    uint32_t to;      // vertex
+    uint32_t field;
+    uint8_t type;     // DependencyType
+    uint8_t kind;     // Graphs::EdgeType
+    uint8_t reserved[2];
+  };
+
+  // Read-only view of a mapped .mp4g file. Every accessor reads the mapping
+  // directly; open() checks every section extent, string and index once, so
+  // the accessors need no bounds checks of their own beyond their arguments.
+  // The values of vertex types and dependency types and kinds are left to
+  // the caller.
+  class MappedAnalysis {
+    public:
+      MappedAnalysis() {}
+      MappedAnalysis(const MappedAnalysis &) = delete;
+      MappedAnalysis& operator=(const MappedAnalysis &) = delete;
+      ~MappedAnalysis() { close(); }
+
+      // Returns false, with the reason in error if given, when the file
+      // cannot be mapped or is not a complete .mp4g file of this version.
+      bool open(const char *path, std::string *error = nullptr);
+      void close();
+
+      const char* fileName() const { return string(header()->fileName); }
+      const char* controlName() const { return string(header()->controlName); }
+      const uint64_t* fingerprint() const { return header()->fingerprint; }
+
+      uint32_t numTables() const { return header()->numTables; }
+      const char* tableName(uint32_t table) const { return string(tables()[table].name); }
+      uint32_t tableVertex(uint32_t table) const { return tables()[table].vertex; }
+      uint32_t tableMemory(uint32_t table) const { return tables()[table].memory; }
+      // Index of the table with this name, or -1.
+      int findTable(const char *name) const;
+      bool keyUses(uint32_t table, uint32_t field) const;
+
+      uint32_t numActions(uint32_t table) const { return tables()[table].numActions; }
+      const char* actionName(uint32_t table, uint32_t action) const;
+      bool actionDefines(uint32_t table, uint32_t action, uint32_t field) const;
+      bool actionUses(uint32_t table, uint32_t action, uint32_t field) const;
+      const uint64_t* actionFingerprint(uint32_t table, uint32_t action) const;
+
+      uint32_t numFields() const { return header()->numFields; }
+      const char* fieldName(uint32_t field) const;
+
+      uint32_t numVertices() const { return header()->numVertices; }
+      const char* vertexName(uint32_t vertex) const;
+      uint32_t vertexType(uint32_t vertex) const;
+      uint32_t numDependencies() const { return header()->numDependencies; }
+      const Mp4gDependency& dependency(uint32_t i) const;
+
+      bool isTableIndependent(uint32_t t1, uint32_t t2) const;
+      bool isActionIndependent(uint32_t t1, uint32_t t2) const;
+      // Whether the two tables are in different arms of one if or switch,
+      // so that no packet is matched against both.
+      bool isExclusive(uint32_t t1, uint32_t t2) const;
+      uint32_t numBranches(uint32_t table) const;
+      void branch(uint32_t table, uint32_t i, uint32_t &id, uint32_t &arm) const;
+      // Whether table `to` is reachable from table `from`; tableOnly follows
+      // TABLE dependencies only.
+      bool reaches(bool tableOnly, uint32_t from, uint32_t to) const;
+
+    private:
+      const Mp4gHeader* header() const { return reinterpret_cast<const Mp4gHeader*>(data); }
+      template <typename T> const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+      }
+      const Mp4gTable* tables() const { return section<Mp4gTable>(header()->tablesOffset); }
+      const char* string(uint32_t index) const;
+      bool setContains(uint32_t set, uint32_t field) const;
+      bool validStrings() const;
+      bool validIndices() const;
+      bool validBranches() const;
+
+      const char *data = nullptr;
+      size_t size = 0;
+  };
+
+} //namespace multip4
+
+#endif
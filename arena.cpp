@@ -0,0 +1,36 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <algorithm>
+#include <cstdint>
+
+#include "arena.h"
+
+namespace multip4 {
+
+  Arena::~Arena() {
+    for (auto f = finalizers.rbegin(); f != finalizers.rend(); ++f)
+      f->destroy(f->object);
+    for (auto block : blocks)
+      delete[] block;
+  }
+
+  void* Arena::allocate(size_t size, size_t align) {
+    size_t pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+    if (cur == nullptr || pad + size > left) {
+      size_t bytes = std::max(blockSize, size + align);
+      cur = new char[bytes];
+      blocks.push_back(cur);
+      left = bytes;
+      reserved += bytes;
+      pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+    }
+    char *p = cur + pad;
+    cur += pad + size;
+    left -= pad + size;
+    used += size;
+    return p;
+  }
+
+} //namespace multip4
@@ -0,0 +1,58 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_ARENA_H
+#define MULTIP4_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace multip4 {
+
+  // Bump allocator that owns every object made through it. All objects are
+  // destroyed, in reverse order of creation, when the arena is destroyed.
+  //
+  // Blocks come from operator new, so with the garbage collector enabled
+  // they are scanned like any other heap object and can safely hold the
+  // only reference to GC memory (e.g. the buffer of a std::vector).
+  class Arena {
+    public:
+      explicit Arena(size_t blockSize = 16 * 1024) : blockSize(blockSize) {}
+      Arena(const Arena &) = delete;
+      Arena& operator=(const Arena &) = delete;
+      ~Arena();
+
+      template <typename T, typename... Args>
+      T* make(Args&&... args) {
+        T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        finalizers.push_back({ [](void *p) { static_cast<T*>(p)->~T(); }, object });
+        return object;
+      }
+
+      // Bytes handed out to objects, and bytes obtained for blocks.
+      size_t bytesUsed() const { return used; }
+      size_t bytesReserved() const { return reserved; }
+
+    private:
+      struct Finalizer {
+        void (*destroy)(void *);
+        void *object;
+      };
+
+      void* allocate(size_t size, size_t align);
+
+      size_t blockSize;
+      std::vector<char*> blocks;
+      char *cur = nullptr;
+      size_t left = 0;
+      size_t used = 0;
+      size_t reserved = 0;
+      std::vector<Finalizer> finalizers;
+  };
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,60 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_CONTENT_HASH_H
+#define MULTIP4_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "lib/cstring.h"
+
+namespace multip4 {
+
+  // 128-bit hash of a sequence of values, for cache keys and IR
+  // fingerprints. The two 64-bit lanes use different mixing (FNV-1a and a
+  // multiply-xorshift), so a collision needs both to collide. Strings are
+  // hashed with their length, so concatenations do not collide.
+  class ContentHash {
+    public:
+      ContentHash& add(const void *data, size_t size) {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+          lo = (lo ^ bytes[i]) * 0x100000001b3ULL;
+          hi = (hi ^ bytes[i]) * 0xff51afd7ed558ccdULL;
+          hi ^= hi >> 29;
+        }
+        return *this;
+      }
+      ContentHash& add(uint64_t value) { return add(&value, sizeof(value)); }
+      ContentHash& add(const std::string &s) {
+        add((uint64_t)s.size());
+        return add(s.data(), s.size());
+      }
+      ContentHash& add(cstring s) {
+        if (s == nullptr)
+          return add(~uint64_t(0));
+        add((uint64_t)s.size());
+        return add(s.c_str(), s.size());
+      }
+
+      bool operator==(const ContentHash &other) const { return lo == other.lo && hi == other.hi; }
+      bool operator!=(const ContentHash &other) const { return !(*this == other); }
+
+      std::string hex() const {
+        char buf[33];
+        snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hi,
+            (unsigned long long)lo);
+        return buf;
+      }
+
+      uint64_t lo = 0xcbf29ce484222325ULL;
+      uint64_t hi = 0x9e3779b97f4a7c15ULL;
+  };
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,412 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include "ir/ir.h"
+#include "lib/log.h"
+#include "lib/error.h"
+#include "lib/exceptions.h"
+#include "lib/nullstream.h"
+#include "frontends/common/applyOptionsPragmas.h"
+#include "frontends/common/parseInput.h"
+#include "frontends/p4/frontend.h"
+#include "frontends/parsers/parserDriver.h"
+
+#include "analysisCache.h"
+#include "driver.h"
+#include "tableAnalyzer.h"
+
+namespace multip4 {
+
+  MidEnd::MidEnd(CompilerOptions& options) {
+    bool isv1 = options.langVersion == CompilerOptions::FrontendVersion::P4_14;
+    refMap.setIsV1(isv1);
+    auto evaluator = new P4::EvaluatorPass(&refMap, &typeMap);
+    setName("MidEnd");
+
+    addPasses({
+        evaluator,
+        new VisitFunctor([this, evaluator]() { toplevel = evaluator->getToplevelBlock(); }),
+    });
+  } 
+
+  // Runs the preprocessor and returns its whole output.
+  static bool preprocessSource(Options &options, std::string &source) {
+    FILE *in = options.preprocess();
+    if (in == nullptr)
+      return false;
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+      source.append(buf, n);
+    options.closeInput(in);
+    return ::errorCount() == 0;
+  }
+
+  static const IR::P4Program* parseSource(Options &options, std::string &source) {
+    FILE *in = fmemopen(&source[0], source.size(), "r");
+    if (in == nullptr) {
+      ::error("%1%: cannot read preprocessed source", options.file);
+      return nullptr;
+    }
+    //Dispatch on the language version the way parseP4File does
+    auto program = options.isv1()
+        ? P4::parseV1Program<FILE*, P4V1::Converter>(in, options.file, 1,
+                                                     options.getDebugHook())
+        : P4::P4ParserDriver::parse(in, options.file);
+    fclose(in);
+    return program;
+  }
+
+  bool analyzeFile(std::ostream &out, Metrics *metrics, ResultWriter *results,
+      IncrementalResult *incremental) {
+    auto& options = Multip4Context::get().options();
+    auto hook = options.getDebugHook();
+
+    //With a cache the source is preprocessed once, hashed, and parsed only
+    //on a miss
+    AnalysisCache cache(options);
+    ContentHash key;
+    const IR::P4Program *program = nullptr;
+    {
+      ScopedTimer timer(metrics, "parse");
+      if (!cache.enabled()) {
+        program = P4::parseP4File(options);
+      } else {
+        std::string source;
+        if (!preprocessSource(options, source))
+          return false;
+        key = cache.key(source);
+        if (cache.replay(key, out, results, metrics)) {
+          if (metrics != nullptr)
+            metrics->set("cacheHit", 1);
+          return ::errorCount() == 0;
+        }
+        program = parseSource(options, source);
+      }
+    }
+    if (program == nullptr || ::errorCount() > 0)
+      return false;
+
+    try {
+      ScopedTimer timer(metrics, "frontend");
+      P4::P4COptionPragmaParser optionsPragmaParser;
+      program->apply(P4::ApplyOptionsPragmas(optionsPragmaParser));
+
+      P4::FrontEnd fe;
+      fe.addDebugHook(hook);
+      program = fe.run(options, program);
+    } catch (const Util::P4CExceptionBase &bug) {
+      std::cerr << bug.what() << std::endl;
+      return false;
+    }
+    if (program == nullptr || ::errorCount() > 0)
+      return false;
+
+    MidEnd midEnd(options);
+    midEnd.addDebugHook(hook);
+    const IR::ToplevelBlock *top = nullptr;
+    try {
+      ScopedTimer timer(metrics, "midend");
+      top = midEnd.process(program);
+      if (options.dumpJsonFile)
+          JSONGenerator(*openFile(options.dumpJsonFile, true)) << program << std::endl;
+    } catch (const Util::P4CExceptionBase &bug) {
+      std::cerr << bug.what() << std::endl;
+      return false;
+    }
+    if (::errorCount() > 0)
+      return false;
+
+    //std::cout << "Generating match-action dependency graphs" << std::endl;
+    if (!cache.enabled()) {
+      TableAnalyzer ta(&midEnd.refMap, &midEnd.typeMap, options, out, metrics, results,
+          incremental);
+      top->getMain()->apply(ta);
+      return ::errorCount() == 0;
+    }
+
+    //Capture the outputs so they can be stored as well as passed on. The
+    //control counters are stored too, so they are recorded even when the
+    //caller did not ask for metrics
+    std::ostringstream capturedOut, capturedRecords;
+    std::vector<cstring> files;
+    Metrics ownMetrics;
+    Metrics *analysisMetrics = metrics != nullptr ? metrics : &ownMetrics;
+    {
+      ResultWriter capture(capturedRecords, options);
+      TableAnalyzer ta(&midEnd.refMap, &midEnd.typeMap, options, capturedOut, analysisMetrics,
+          results != nullptr ? &capture : nullptr, incremental);
+      top->getMain()->apply(ta);
+      files = ta.outputFiles();
+    }
+    out << capturedOut.str();
+    if (results != nullptr) {
+      std::istringstream records(capturedRecords.str());
+      results->append(records);
+    }
+    if (::errorCount() > 0)
+      return false;
+    cache.store(key, capturedOut.str(), capturedRecords.str(), files, *analysisMetrics);
+    if (metrics != nullptr)
+      metrics->set("cacheHit", 0);
+    return true;
+  }
+
+  bool analyzeInNewContext(cstring file, std::ostream &out, Metrics *metrics,
+      ResultWriter *results) {
+    // A fresh context per file gives each file its own options copy and
+    // error count, while sharing the process-wide startup work.
+    AutoCompileContext fileContext(new Multip4Context(Multip4Context::get()));
+    Multip4Context::get().options().file = file;
+
+    bool ok = false;
+    try {
+      ok = analyzeFile(out, metrics, results);
+    } catch (const Util::P4CExceptionBase &bug) {
+      std::cerr << bug.what() << std::endl;
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+    if (!ok)
+      std::cerr << "[ERROR] " << file << ": analysis failed" << std::endl;
+    if (metrics != nullptr) {
+      metrics->set("failed", !ok);
+      metrics->set("errors", ::errorCount());
+      // Process-wide, so in a batch it covers every file analyzed so far
+      metrics->set("processPeakRssKb", peakRssKb());
+    }
+    return ok;
+  }
+
+  bool analyzeIncrementally(cstring file, cstring stateDir, std::ostream &out,
+      IncrementalResult *result, ResultWriter *results) {
+    AutoCompileContext fileContext(new Multip4Context(Multip4Context::get()));
+    auto &options = Multip4Context::get().options();
+    options.file = file;
+    options.incrementalDir = stateDir;
+    options.noCache = true;
+
+    try {
+      return analyzeFile(out, nullptr, results, result);
+    } catch (const Util::P4CExceptionBase &bug) {
+      std::cerr << bug.what() << std::endl;
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+    return false;
+  }
+
+  static bool analyzeAndRecord(cstring file, std::ostream &out, std::ostream *statsJson,
+      ResultWriter *results) {
+    if (statsJson == nullptr)
+      return analyzeInNewContext(file, out, nullptr, results);
+    Metrics metrics(file);
+    bool ok = analyzeInNewContext(file, out, &metrics, results);
+    metrics.writeJson(*statsJson);
+    *statsJson << "\n";
+    return ok;
+  }
+
+  unsigned analyzeBatch(const std::vector<cstring> &files, std::ostream &out,
+      std::ostream *statsJson, ResultWriter *results) {
+    unsigned failed = 0;
+    for (auto file : files) {
+      if (!analyzeAndRecord(file, out, statsJson, results))
+        failed++;
+    }
+    return failed;
+  }
+
+  enum FileStatus : unsigned char { FilePending = 0, FileAnalyzed, FileFailed };
+
+  static void *allocShared(size_t size) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  static std::string resultPath(const std::string &dir, size_t index) {
+    return dir + "/" + std::to_string(index);
+  }
+
+  static std::string statsPath(const std::string &dir, size_t index) {
+    return resultPath(dir, index) + ".json";
+  }
+
+  static std::string recordsPath(const std::string &dir, size_t index) {
+    return resultPath(dir, index) + ".records";
+  }
+
+  static void appendFile(const std::string &path, std::ostream &out) {
+    std::ifstream in(path);
+    if (in.peek() != std::ifstream::traits_type::eof())
+      out << in.rdbuf();
+  }
+
+  // Workers claim files one at a time from the shared cursor, so a worker
+  // stuck on one large program never holds back files queued behind it.
+  static void runWorker(const std::vector<cstring> &files, std::atomic<unsigned> *next,
+      unsigned char *status, const std::string &dir, bool keepStats, bool keepRecords) {
+    for (;;) {
+      unsigned i = next->fetch_add(1);
+      if (i >= files.size())
+        break;
+      std::ofstream result(resultPath(dir, i));
+      std::ofstream stats;
+      if (keepStats)
+        stats.open(statsPath(dir, i));
+      std::ofstream records;
+      bool ok;
+      if (keepRecords) {
+        records.open(recordsPath(dir, i));
+        ResultWriter results(records, Multip4Context::get().options());
+        ok = analyzeAndRecord(files[i], result, keepStats ? &stats : nullptr, &results);
+      } else {
+        ok = analyzeAndRecord(files[i], result, keepStats ? &stats : nullptr, nullptr);
+      }
+      result.close();
+      stats.close();
+      records.close();
+      status[i] = ok ? FileAnalyzed : FileFailed;
+    }
+  }
+
+  unsigned analyzeParallel(const std::vector<cstring> &files, unsigned jobs,
+      std::ostream &out, std::ostream *statsJson, ResultWriter *results) {
+    if (jobs <= 1 || files.size() <= 1)
+      return analyzeBatch(files, out, statsJson, results);
+
+    const char *tmp = getenv("TMPDIR");
+    std::string dir = std::string(tmp != nullptr ? tmp : "/tmp") + "/p4c-multip4-XXXXXX";
+    auto next = static_cast<std::atomic<unsigned>*>(allocShared(sizeof(std::atomic<unsigned>)));
+    auto status = static_cast<unsigned char*>(allocShared(files.size()));
+    bool haveDir = mkdtemp(&dir[0]) != nullptr;
+    if (!haveDir || next == nullptr || status == nullptr) {
+      ::warning("cannot set up worker processes; analyzing serially");
+      if (haveDir)
+        rmdir(dir.c_str());
+      if (next != nullptr)
+        munmap(next, sizeof(std::atomic<unsigned>));
+      if (status != nullptr)
+        munmap(status, files.size());
+      return analyzeBatch(files, out, statsJson, results);
+    }
+    new (next) std::atomic<unsigned>(0);
+
+    // Flush before forking so buffered output is not written by every child.
+    out.flush();
+    if (statsJson != nullptr)
+      statsJson->flush();
+    if (results != nullptr)
+      results->flush();
+    std::cout.flush();
+    std::cerr.flush();
+
+    unsigned running = 0;
+    auto spawn = [&]() {
+      pid_t pid = fork();
+      if (pid == 0) {
+        runWorker(files, next, status, dir, statsJson != nullptr, results != nullptr);
+        _exit(0);
+      }
+      if (pid > 0)
+        running++;
+      else
+        runWorker(files, next, status, dir, statsJson != nullptr, results != nullptr);
+    };
+    for (unsigned w = 0; w < std::min<size_t>(jobs, files.size()); w++)
+      spawn();
+
+    while (running > 0) {
+      int wstatus;
+      pid_t pid = waitpid(-1, &wstatus, 0);
+      if (pid < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      running--;
+      // A crashed worker loses only the file it was analyzing; replace it
+      // while there are files left to claim.
+      bool clean = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+      if (!clean && next->load() < files.size())
+        spawn();
+    }
+
+    unsigned failed = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+      auto path = resultPath(dir, i);
+      if (status[i] == FilePending) {
+        std::cerr << "[ERROR] " << files[i] << ": worker terminated abnormally" << std::endl;
+        failed++;
+      } else {
+        if (status[i] == FileFailed)
+          failed++;
+        appendFile(path, out);
+        if (statsJson != nullptr)
+          appendFile(statsPath(dir, i), *statsJson);
+        if (results != nullptr) {
+          std::ifstream records(recordsPath(dir, i));
+          results->append(records);
+        }
+      }
+      unlink(path.c_str());
+      unlink(statsPath(dir, i).c_str());
+      unlink(recordsPath(dir, i).c_str());
+    }
+    rmdir(dir.c_str());
+    munmap(next, sizeof(std::atomic<unsigned>));
+    munmap(status, files.size());
+    return failed;
+  }
+
+  std::vector<cstring> readBatchInputs(cstring listOrDir) {
+    std::vector<cstring> files;
+    struct stat st;
+    if (stat(listOrDir, &st) != 0) {
+      ::error("%1%: cannot access batch input", listOrDir);
+      return files;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+      DIR *dir = opendir(listOrDir);
+      if (dir == nullptr) {
+        ::error("%1%: cannot open directory", listOrDir);
+        return files;
+      }
+      while (auto entry = readdir(dir)) {
+        cstring name = entry->d_name;
+        if (name.endsWith(".p4"))
+          files.push_back(listOrDir + "/" + name);
+      }
+      closedir(dir);
+      std::sort(files.begin(), files.end());
+      return files;
+    }
+
+    std::ifstream list(listOrDir);
+    std::string line;
+    while (std::getline(list, line)) {
+      if (line.empty() || line[0] == '#')
+        continue;
+      files.push_back(line);
+    }
+    return files;
+  }
+
+} //namespace multip4
@@ -0,0 +1,74 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_DRIVER_H
+#define MULTIP4_DRIVER_H
+
+#include <vector>
+
+#include <ostream>
+
+#include "ir/ir.h"
+#include "frontends/p4/evaluator/evaluator.h"
+
+#include "incremental.h"
+#include "instrumentation.h"
+#include "multip4Options.h"
+#include "resultWriter.h"
+
+namespace multip4 {
+
+  class MidEnd : public PassManager {
+    public:
+      P4::ReferenceMap    refMap;
+      P4::TypeMap         typeMap;
+      IR::ToplevelBlock   *toplevel = nullptr;
+
+      explicit MidEnd(CompilerOptions& options);
+      IR::ToplevelBlock* process(const IR::P4Program *&program) {
+          program = program->apply(*this);
+          return toplevel;
+      }
+  };
+
+  // Runs the frontend, MidEnd and TableAnalyzer on the file named by the
+  // options of the current compile context, writing the Stat lines to out.
+  // Phase times are added to metrics and analysis records written to results
+  // if they are given. Returns false on any error. With
+  // Options::incrementalDir set, what was reused is added to incremental.
+  bool analyzeFile(std::ostream &out, Metrics *metrics = nullptr,
+      ResultWriter *results = nullptr, IncrementalResult *incremental = nullptr);
+
+  // Analyzes one file in a fresh compile context copied from the current
+  // one, so its errors do not leak into the next file.
+  bool analyzeInNewContext(cstring file, std::ostream &out, Metrics *metrics = nullptr,
+      ResultWriter *results = nullptr);
+
+  // Entry point for editor plugins and watch loops: analyzes file in a fresh
+  // context with its per-control state kept in stateDir, so each call only
+  // walks the controls changed since the previous call on the same file.
+  // The output cache is bypassed, since a hit would leave the state stale.
+  bool analyzeIncrementally(cstring file, cstring stateDir, std::ostream &out,
+      IncrementalResult *result = nullptr, ResultWriter *results = nullptr);
+
+  // Analyzes each file in turn. If statsJson is given, the Metrics of every
+  // file are written to it as one JSON line. Returns the number of files
+  // that failed.
+  unsigned analyzeBatch(const std::vector<cstring> &files, std::ostream &out,
+      std::ostream *statsJson = nullptr, ResultWriter *results = nullptr);
+
+  // Spreads the files over `jobs` worker processes that each take the next
+  // unanalyzed file when they become idle. Output, stats lines and records
+  // are written in input order. Returns the number of files that failed.
+  unsigned analyzeParallel(const std::vector<cstring> &files, unsigned jobs,
+      std::ostream &out, std::ostream *statsJson = nullptr,
+      ResultWriter *results = nullptr);
+
+  // Expands a --batch argument: every *.p4 file of a directory, or the
+  // non-empty, non-comment lines of a list file.
+  std::vector<cstring> readBatchInputs(cstring listOrDir);
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,170 @@
+/*
+Written by Seungbin Song
+*/
+
+#include "exprSet.h"
+
+#include <algorithm>
+
+namespace multip4 {
+
+  int FieldInterner::intern(cstring name) {
+    auto it = ids.find(name);
+    if (it != ids.end())
+      return it->second;
+    int id = (int)names.size();
+    ids.emplace(name, id);
+    names.push_back(name);
+    locations.push_back(locate(name));
+    overlaps.emplace_back();
+
+    //Candidates have the same path, a path below it or a path above it
+    const auto &path = locations[id].path;
+    std::vector<const std::vector<int>*> candidates;
+    std::vector<std::string> prefixes;
+    for (size_t i = 0; i < path.size(); i++) {
+      if (path[i] == '.')
+        prefixes.push_back(path.substr(0, i));
+    }
+    for (auto &prefix : prefixes) {
+      auto found = byPath.find(prefix);
+      if (found != byPath.end())
+        candidates.push_back(&found->second);
+    }
+    for (auto index : {&byPath, &byPrefix}) {
+      auto found = index->find(path);
+      if (found != index->end())
+        candidates.push_back(&found->second);
+    }
+    for (auto list : candidates) {
+      for (auto other : *list) {
+        if (overlap(locations[id], locations[other])) {
+          overlaps[id].push_back(other);
+          overlaps[other].push_back(id);
+        }
+      }
+    }
+    byPath[path].push_back(id);
+    for (auto &prefix : prefixes)
+      byPrefix[prefix].push_back(id);
+    return id;
+  }
+
+  FieldInterner::Location FieldInterner::locate(cstring name) {
+    Location location;
+    std::string text = name.c_str();
+    size_t i = 0;
+    while (i < text.size()) {
+      if (text[i] != '[') {
+        location.path += text[i++];
+        continue;
+      }
+      //Index expressions may have brackets of their own
+      size_t close = i + 1;
+      for (int depth = 1; close < text.size(); close++) {
+        if (text[close] == '[')
+          depth++;
+        else if (text[close] == ']' && --depth == 0)
+          break;
+      }
+      std::string inside = text.substr(i + 1, close - i - 1);
+      i = close + 1;
+      size_t colon = inside.find(':');
+      auto digits = [](const std::string &s) {
+        return !s.empty() && s.size() <= 9 &&
+          s.find_first_not_of("0123456789") == std::string::npos;
+      };
+      if (i >= text.size() && colon != std::string::npos &&
+          digits(inside.substr(0, colon)) && digits(inside.substr(colon + 1))) {
+        location.hi = std::stoul(inside.substr(0, colon));
+        location.lo = std::stoul(inside.substr(colon + 1));
+      } else {
+        location.elements.push_back(digits(inside) ? std::stoi(inside) : AnyElement);
+      }
+    }
+    return location;
+  }
+
+  bool FieldInterner::overlap(const Location &a, const Location &b) {
+    size_t n = std::min(a.elements.size(), b.elements.size());
+    for (size_t i = 0; i < n; i++) {
+      if (a.elements[i] != b.elements[i] && a.elements[i] != AnyElement &&
+          b.elements[i] != AnyElement)
+        return false;
+    }
+    //A header and one of its fields always share bits; slices only when
+    //their ranges meet
+    if (a.path != b.path)
+      return true;
+    return a.lo <= b.hi && b.lo <= a.hi;
+  }
+
+  ExprSet::iterator::iterator(const uint64_t *bits, size_t numWords, size_t word)
+    : bits(bits), numWords(numWords), word(word), cur(word < numWords ? bits[word] : 0) {
+    skipEmpty();
+  }
+
+  ExprSet::iterator& ExprSet::iterator::operator++() {
+    cur &= cur - 1;
+    skipEmpty();
+    return *this;
+  }
+
+  void ExprSet::iterator::skipEmpty() {
+    while (cur == 0 && word < numWords) {
+      ++word;
+      cur = word < numWords ? bits[word] : 0;
+    }
+  }
+
+  void ExprSet::grow(size_t words) {
+    if (words <= numWords)
+      return;
+    if (numWords <= InlineWords)
+      heapBits.assign(inlineBits, inlineBits + numWords);
+    heapBits.resize(words, 0);
+    numWords = words;
+  }
+
+  void ExprSet::insert(int id) {
+    grow(id / 64 + 1);
+    data()[id / 64] |= uint64_t(1) << (id % 64);
+  }
+
+  bool ExprSet::contains(int id) const {
+    return (word(id / 64) >> (id % 64)) & 1;
+  }
+
+  bool ExprSet::empty() const {
+    for (size_t w = 0; w < numWords; w++)
+      if (data()[w] != 0)
+        return false;
+    return true;
+  }
+
+  size_t ExprSet::size() const {
+    size_t count = 0;
+    for (size_t w = 0; w < numWords; w++)
+      count += __builtin_popcountll(data()[w]);
+    return count;
+  }
+
+  ExprSet& ExprSet::operator|=(const ExprSet &other) {
+    grow(other.numWords);
+    uint64_t *dst = data();
+    const uint64_t *src = other.data();
+    for (size_t w = 0; w < other.numWords; w++)
+      dst[w] |= src[w];
+    return *this;
+  }
+
+  ExprSet& ExprSet::insertAllExcept(const ExprSet &add, const ExprSet &except) {
+    grow(add.numWords);
+    uint64_t *dst = data();
+    const uint64_t *src = add.data();
+    for (size_t w = 0; w < add.numWords; w++)
+      dst[w] |= src[w] & ~except.word(w);
+    return *this;
+  }
+
+} //namespace multip4
@@ -0,0 +1,119 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_EXPR_SET_H
+#define MULTIP4_EXPR_SET_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lib/cstring.h"
+
+namespace multip4 {
+
+  // Maps every field name found by TableAnalyzer::findId to a dense integer
+  // ID. One interner is shared by all controls of a program.
+  //
+  // A name may end in a bit slice, hdr.h.f[15:8], and may index header
+  // stacks, hdr.s[2].f; an index that is not a constant (hdr.s[i].f,
+  // hdr.s[next].f) may be any element. Different names can therefore share
+  // bits: a field and its slices, overlapping slices, a header and its fields
+  // (a header copy writes them all), a constant and a dynamic element of one
+  // stack. overlapping() lists these, while disjoint slices and distinct
+  // elements stay apart.
+  class FieldInterner {
+    public:
+      int intern(cstring name);
+      // ID of an interned name, or -1.
+      int find(cstring name) const {
+        auto it = ids.find(name);
+        return it == ids.end() ? -1 : it->second;
+      }
+      cstring name(int id) const { return names[id]; }
+      size_t size() const { return names.size(); }
+      // The other interned fields that share bits with id.
+      const std::vector<int>& overlapping(int id) const { return overlaps[id]; }
+
+    private:
+      static const int AnyElement = -1;
+
+      struct Location {
+        // The name without its brackets
+        std::string path;
+        // Index of every stack element on the path, or AnyElement
+        std::vector<int> elements;
+        // Bits of the field; all of them unless the name ends in a slice
+        unsigned lo = 0, hi = UINT32_MAX;
+      };
+      static Location locate(cstring name);
+      static bool overlap(const Location &a, const Location &b);
+
+      std::unordered_map<cstring, int> ids;
+      std::vector<cstring> names;
+      std::vector<Location> locations;
+      std::vector<std::vector<int>> overlaps;
+      // IDs by path, and by every proper prefix of their path (hdr.h for
+      // hdr.h.f), to find the candidates for overlapping a new name
+      std::unordered_map<std::string, std::vector<int>> byPath;
+      std::unordered_map<std::string, std::vector<int>> byPrefix;
+  };
+
+  // A set of interned field IDs stored as a bitset. Sets whose largest ID
+  // fits in InlineWords words are kept inline; wider sets spill to the heap.
+  class ExprSet {
+    public:
+      class iterator {
+        public:
+          iterator(const uint64_t *bits, size_t numWords, size_t word);
+          int operator*() const { return (int)(word * 64 + __builtin_ctzll(cur)); }
+          iterator& operator++();
+          bool operator!=(const iterator &other) const {
+            return word != other.word || cur != other.cur;
+          }
+
+        private:
+          void skipEmpty();
+
+          const uint64_t *bits;
+          size_t numWords;
+          size_t word;
+          uint64_t cur;
+      };
+
+      void insert(int id);
+      bool contains(int id) const;
+      bool empty() const;
+      size_t size() const;
+      // Bytes of the heap words of a set too wide to be kept inline.
+      size_t heapBytes() const {
+        return numWords > InlineWords ? heapBits.capacity() * sizeof(uint64_t) : 0;
+      }
+
+      ExprSet& operator|=(const ExprSet &other);
+      // this |= (add & ~except), without materializing the difference.
+      ExprSet& insertAllExcept(const ExprSet &add, const ExprSet &except);
+
+      iterator begin() const { return iterator(data(), numWords, 0); }
+      iterator end() const { return iterator(data(), numWords, numWords); }
+
+    private:
+      static const size_t InlineWords = 2;
+
+      uint64_t* data() { return numWords <= InlineWords ? inlineBits : heapBits.data(); }
+      const uint64_t* data() const {
+        return numWords <= InlineWords ? inlineBits : heapBits.data();
+      }
+      uint64_t word(size_t w) const { return w < numWords ? data()[w] : 0; }
+      void grow(size_t words);
+
+      size_t numWords = InlineWords;
+      uint64_t inlineBits[InlineWords] = {0, 0};
+      std::vector<uint64_t> heapBits;
+  };
+
+} //namespace multip4
+
+#endif
@@ -15,8 +15,8 @@ limitations under the License.
 */
 
 #include <boost/graph/graphviz.hpp>
-#include <boost/graph/filtered_graph.hpp>
-#include <boost/graph/breadth_first_search.hpp>
+
+#include <algorithm>
 
 #include "lib/log.h"
 #include "lib/error.h"
@@ -29,96 +29,392 @@ limitations under the License.
 
 namespace multip4 {
 
-class edge_predicate_c {
-  public:
-    edge_predicate_c() : g(0) {}
-    edge_predicate_c(Graphs::Graph &_g) : g(&_g) {}
-    bool operator()(const Graphs::edge_t& edge) const {
-      const auto &einfo = (*g)[edge];
-      Graphs::EdgeType type = einfo.type;
-      return (type == Graphs::EdgeType::TABLE);
+void ReachabilityMatrix::reset(size_t numVertices) {
+  words = (numVertices + 63) / 64;
+  bits.assign(numVertices * words, 0);
+}
+
+void ReachabilityMatrix::set(size_t from, size_t to) {
+  bits[from * words + to / 64] |= uint64_t(1) << (to % 64);
+}
+
+void ReachabilityMatrix::merge(size_t into, size_t from) {
+  uint64_t *dst = &bits[into * words];
+  const uint64_t *src = &bits[from * words];
+  for (size_t w = 0; w < words; w++)
+    dst[w] |= src[w];
+}
+
+bool ReachabilityMatrix::test(size_t from, size_t to) const {
+  return (bits[from * words + to / 64] >> (to % 64)) & 1;
+}
+
+void Graphs::finalize() {
+  if (finalized)
+    return;
+  // Counting sort on the source vertex; it is stable, so every vertex keeps
+  // its out-edges in insertion order.
+  auto &offsets = allEdges.offsets;
+  size_t n = vertexTypes.size();
+  offsets.assign(n + 1, 0);
+  for (auto &e : edgeList)
+    offsets[e.from + 1]++;
+  for (size_t v = 0; v < n; v++)
+    offsets[v + 1] += offsets[v];
+  allEdges.targets.resize(edgeList.size());
+  allEdges.labels.resize(edgeList.size());
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (auto &e : edgeList) {
+    auto i = fill[e.from]++;
+    allEdges.targets[i] = e.to;
+    allEdges.labels[i] = e.label;
+    if (dedupEdges) {
+      allEdges.labels[i] = edgeLabel(labelValue(e.label),
+                                     mergedType(mergedLabels[labelValue(e.label)].kinds));
     }
-  private:
-    Graphs::Graph *g;
-};
+  }
+  std::vector<EdgeRecord>().swap(edgeList);
+  finalized = true;
+  viewsValid = false;
+}
+
+void Graphs::unfinalize() {
+  if (!finalized)
+    return;
+  const auto &offsets = allEdges.offsets;
+  edgeList.reserve(allEdges.targets.size());
+  for (vertex_t v = 0; v + 1 < offsets.size(); v++) {
+    for (auto i = offsets[v]; i < offsets[v + 1]; i++)
+      edgeList.push_back({v, allEdges.targets[i], allEdges.labels[i]});
+  }
+  allEdges = EdgeView();
+  tableEdges = EdgeView();
+  actionEdges = EdgeView();
+  statefulEdges = EdgeView();
+  finalized = false;
+  viewsValid = false;
+}
+
+size_t Graphs::EdgeView::bytes() const {
+  return offsets.capacity() * sizeof(uint32_t) + targets.capacity() * sizeof(uint32_t) +
+    labels.capacity() * sizeof(uint32_t);
+}
+
+size_t Graphs::bytes() const {
+  return vertexNames.capacity() * sizeof(cstring) +
+    vertexTypes.capacity() * sizeof(VertexType) +
+    edgeList.capacity() * sizeof(EdgeRecord) +
+    allEdges.bytes() + tableEdges.bytes() + actionEdges.bytes() + statefulEdges.bytes() +
+    reachAll.bytes() + reachTable.bytes() +
+    mergedLabels.capacity() * sizeof(EdgeLabels) +
+    mergedIndex.size() * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(void*));
+}
+
+bool Graphs::hasActionDependency(uint32_t label) const {
+  if (dedupEdges)
+    return mergedLabels[labelValue(label)].kinds & ActionEdge;
+  return labelType(label) == EdgeType::ACTION;
+}
+
+bool Graphs::hasStatefulDependency(uint32_t label) const {
+  if (dedupEdges)
+    return mergedLabels[labelValue(label)].kinds & StatefulEdge;
+  return labelType(label) == EdgeType::STATEFUL;
+}
+
+// Copies the edges of `all` that pass keep into view, in O(V + E).
+template <typename Keep>
+static void filterEdges(const Graphs::EdgeView &all, Graphs::EdgeView &view, Keep keep) {
+  size_t n = all.offsets.size() - 1;
+  view.offsets.assign(n + 1, 0);
+  view.targets.clear();
+  view.labels.clear();
+  for (size_t v = 0; v < n; v++) {
+    for (auto i = all.offsets[v]; i < all.offsets[v + 1]; i++) {
+      if (keep(all.labels[i])) {
+        view.targets.push_back(all.targets[i]);
+        view.labels.push_back(all.labels[i]);
+      }
+    }
+    view.offsets[v + 1] = view.targets.size();
+  }
+}
+
+void Graphs::buildViews() {
+  finalize();
+  if (viewsValid)
+    return;
+  filterEdges(allEdges, tableEdges, [](uint32_t label) { return isTableEdge(label); });
+  filterEdges(allEdges, actionEdges,
+              [this](uint32_t label) { return hasActionDependency(label); });
+  filterEdges(allEdges, statefulEdges,
+              [this](uint32_t label) { return hasStatefulDependency(label); });
+  viewsValid = true;
+}
+
+const Graphs::EdgeView& Graphs::edgeView(EdgeFilter filter) {
+  buildViews();
+  switch (filter) {
+    case EdgeFilter::TABLE:
+      return tableEdges;
+    case EdgeFilter::ACTION:
+      return actionEdges;
+    case EdgeFilter::STATEFUL:
+      return statefulEdges;
+    default:
+      return allEdges;
+  }
+}
+
+void Graphs::presetReachability(vertex_t from, std::vector<vertex_t> all,
+                                std::vector<vertex_t> tableOnly) {
+  presetRows.push_back({from, std::move(all), std::move(tableOnly)});
+  reachabilityValid = false;
+}
 
+// Kahn's algorithm over the finalized edges.
+bool Graphs::topologicalOrder(std::vector<vertex_t> &order) {
+  finalize();
+  const auto &offsets = allEdges.offsets;
+  const auto &targets = allEdges.targets;
+  size_t n = vertexTypes.size();
+  std::vector<uint32_t> inDegree(n, 0);
+  for (auto to : targets)
+    inDegree[to]++;
+  order.clear();
+  order.reserve(n);
+  for (vertex_t v = 0; v < n; v++) {
+    if (inDegree[v] == 0)
+      order.push_back(v);
+  }
+  for (size_t head = 0; head < order.size(); head++) {
+    auto v = order[head];
+    for (auto i = offsets[v]; i < offsets[v + 1]; i++) {
+      if (--inDegree[targets[i]] == 0)
+        order.push_back(targets[i]);
+    }
+  }
+  return order.size() == n;
+}
 
-class bfs_visitor : public boost::default_bfs_visitor {
+// Both depths are relaxed along the same topological order. A vertex's
+// depth is the number of tables on the longest path that ends in it;
+// conditions count for nothing.
+Graphs::PathDepths Graphs::longestPaths() {
+  PathDepths result;
+  finalize();
+  std::vector<vertex_t> order;
+  if (!topologicalOrder(order)) {
+    ::warning("Dependence graph has a cycle; pipeline depth is not computed");
+    return result;
+  }
 
- public:
-    void discover_vertex(const Graphs::vertex_t &v, 
-        const Graphs::Graph &g __attribute__((unused))) {
-      if(v == to) 
-        (*result) = 1;
+  size_t n = vertexTypes.size();
+  std::vector<unsigned> depth(n, 0), tableDepth(n, 0);
+  std::vector<int> previous(n, -1);
+  int deepest = -1;
+  for (auto v : order) {
+    unsigned weight = isCondition(v) ? 0 : 1;
+    depth[v] += weight;
+    tableDepth[v] += weight;
+    if (deepest < 0 || depth[v] > depth[deepest])
+      deepest = v;
+    if (weight != 0) {
+      result.depth = std::max(result.depth, depth[v]);
+      result.tableDepth = std::max(result.tableDepth, tableDepth[v]);
+      if (result.levelWidths.size() < depth[v])
+        result.levelWidths.resize(depth[v], 0);
+      result.levelWidths[depth[v] - 1]++;
     }
-    
-    void discover_vertex(const Graphs::vertex_t &v,
-        const boost::filtered_graph<Graphs::Graph, edge_predicate_c> &g __attribute__((unused))) {
-      if(v == to)
-        (*result) = 1;
+    for (auto i = allEdges.offsets[v]; i < allEdges.offsets[v + 1]; i++) {
+      auto to = allEdges.targets[i];
+      if (depth[v] > depth[to]) {
+        depth[to] = depth[v];
+        previous[to] = v;
+      }
+      if (isTableEdge(allEdges.labels[i]))
+        tableDepth[to] = std::max(tableDepth[to], tableDepth[v]);
     }
+  }
 
-    bfs_visitor(const Graphs::vertex_t &v, int *r):to(v), result(r){ }
+  for (int v = deepest; v >= 0; v = previous[v]) {
+    if (!isCondition(v))
+      result.criticalTables.push_back(v);
+  }
+  std::reverse(result.criticalTables.begin(), result.criticalTables.end());
+  return result;
+}
 
-  private:
-    Graphs::vertex_t to;
-    int *result;
-};
+// Rows are merged in reverse topological order (Kahn's algorithm, read
+// backwards), so each successor's row is complete before it is merged into
+// its predecessors.
+void Graphs::buildReachability() {
+  if (reachabilityValid || useBfs)
+    return;
+  finalize();
 
-bool Graphs::isActionIndependent(const vertex_t &v1, const vertex_t &v2) {
-  boost::filtered_graph<Graph, edge_predicate_c> fg(g, edge_predicate_c(g));
+  const auto &offsets = allEdges.offsets;
+  const auto &targets = allEdges.targets;
+  size_t n = vertexTypes.size();
+  std::vector<vertex_t> order;
+  if (!topologicalOrder(order)) {
+    ::warning("Dependence graph has a cycle; falling back to BFS queries");
+    useBfs = true;
+    return;
+  }
 
-  int r1 = 0;
-  bfs_visitor vis1(v2, &r1);
-  breadth_first_search(fg, v1, boost::visitor(vis1));
-  if (r1 == 1)
-    return false;
-  
-  int r2 = 0;
-  bfs_visitor vis2(v1, &r2);
-  breadth_first_search(fg, v2, boost::visitor(vis2));
-  if (r2 == 1)
-    return false;
+  reachAll.reset(n);
+  reachTable.reset(n);
+  std::vector<bool> preset(n, false);
+  for (auto &row : presetRows) {
+    preset[row.from] = true;
+    for (auto to : row.all)
+      reachAll.set(row.from, to);
+    for (auto to : row.tableOnly)
+      reachTable.set(row.from, to);
+  }
+  rowsComputed = 0;
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    auto v = *it;
+    if (preset[v])
+      continue;
+    rowsComputed++;
+    for (auto i = offsets[v]; i < offsets[v + 1]; i++) {
+      auto to = targets[i];
+      reachAll.set(v, to);
+      reachAll.merge(v, to);
+      if (isTableEdge(allEdges.labels[i])) {
+        reachTable.set(v, to);
+        reachTable.merge(v, to);
+      }
+    }
+  }
+  reachabilityValid = true;
+}
 
-  return true;
+// Breadth-first search over one edge view.
+bool Graphs::reaches(vertex_t from, vertex_t to, const EdgeView &edges) {
+  bfsCount.fetch_add(1, std::memory_order_relaxed);
+  std::vector<bool> seen(vertexTypes.size(), false);
+  std::vector<vertex_t> queue = {from};
+  seen[from] = true;
+  for (size_t head = 0; head < queue.size(); head++) {
+    auto v = queue[head];
+    for (auto i = edges.offsets[v]; i < edges.offsets[v + 1]; i++) {
+      auto next = edges.targets[i];
+      if (next == to)
+        return true;
+      if (!seen[next]) {
+        seen[next] = true;
+        queue.push_back(next);
+      }
+    }
+  }
+  return false;
+}
+
+bool Graphs::reachable(const vertex_t &from, const vertex_t &to, bool tableOnly) {
+  buildReachability();
+  if (!useBfs)
+    return tableOnly ? reachTable.test(from, to) : reachAll.test(from, to);
+  return reaches(from, to, edgeView(tableOnly ? EdgeFilter::TABLE : EdgeFilter::ALL));
 }
 
+bool Graphs::isActionIndependent(const vertex_t &v1, const vertex_t &v2) {
+  return !reachable(v1, v2, true) && !reachable(v2, v1, true);
+}
 
 bool Graphs::isTableIndependent(const vertex_t &v1, const vertex_t &v2) {
-  int r1 = 0;
-  bfs_visitor vis1(v2, &r1);
-  breadth_first_search(g, v1, boost::visitor(vis1));
-  if (r1 == 1)
-    return false;
-  
-  int r2 = 0;
-  bfs_visitor vis2(v1, &r2);
-  breadth_first_search(g, v2, boost::visitor(vis2));
-  if (r2 == 1)
-    return false;
-  
-  return true;
-}
-
-bool Graphs::isCondition(const vertex_t &v) {
-  const auto &vinfo = g[v];
-  return (vinfo.type == VertexType::CONDITION);
+  return !reachable(v1, v2, false) && !reachable(v2, v1, false);
 }
 
 Graphs::vertex_t Graphs::add_vertex(const cstring &name, VertexType type) {
-    auto v = boost::add_vertex(g);
-    boost::put(&Vertex::name, g, v, name);
-    boost::put(&Vertex::type, g, v, type);
-    return g.local_to_global(v);
+    vertex_t v = vertexTypes.size();
+    vertexNames.push_back(name);
+    vertexTypes.push_back(type);
+    if (finalized)
+      allEdges.offsets.push_back(allEdges.offsets.back());
+    viewsValid = false;
+    reachabilityValid = false;
+    return v;
 }
 
-void Graphs::add_edge(const vertex_t &from, const vertex_t &to, const cstring &name, EdgeType type) {
-    auto ep = boost::add_edge(from, to, g);
-    boost::put(&Edge::name, g, ep.first, name);
-    boost::put(&Edge::type, g, ep.first, type);
+void Graphs::add_edge(const vertex_t &from, const vertex_t &to, int field, EdgeType type,
+                      DependencyType dependency) {
+    presetRows.clear();
+    if (!dedupEdges) {
+      unfinalize();
+      edgeList.push_back({from, to, edgeLabel(field, type)});
+      reachabilityValid = false;
+      return;
+    }
+
+    static const uint8_t dependencyKinds[] = {UseDefEdge, DefUseEdge, DefDefEdge};
+    static const uint8_t edgeKinds[] = {TableEdge, ActionEdge, StatefulEdge};
+    uint8_t kinds = dependencyKinds[dependency] | edgeKinds[(int)type];
+    uint64_t key = (uint64_t)from << 32 | to;
+    auto it = mergedIndex.find(key);
+    if (it == mergedIndex.end()) {
+      it = mergedIndex.emplace(key, mergedLabels.size()).first;
+      mergedLabels.emplace_back();
+      unfinalize();
+      edgeList.push_back({from, to, edgeLabel(it->second, EdgeType::ACTION)});
+      reachabilityValid = false;
+    }
+    auto &merged = mergedLabels[it->second];
+    if (mergedType(merged.kinds | kinds) != mergedType(merged.kinds)) {
+      // The finalized label and the edge views hold the old type, and the
+      // edge may now count for TABLE reachability
+      unfinalize();
+      viewsValid = false;
+      reachabilityValid = false;
+    }
+    merged.kinds |= kinds;
+    merged.fields.insert(field);
 }
 
-void Graphs::writeGraphToFile(const cstring &name) {
+cstring Graphs::edgeName(uint32_t label, const FieldInterner &fields) const {
+  if (!dedupEdges)
+    return fields.name(labelValue(label));
+  // The fields, then the dependency kinds merged into the edge:
+  // "hdr.a, meta.b [DefUse DefDef]"
+  static const std::pair<uint8_t, const char*> kindNames[] = {
+    {UseDefEdge, "UseDef"}, {DefUseEdge, "DefUse"}, {DefDefEdge, "DefDef"}
+  };
+  const auto &merged = mergedLabels[labelValue(label)];
+  std::string name;
+  for (auto f : merged.fields) {
+    if (!name.empty())
+      name += ", ";
+    name += fields.name(f).c_str();
+  }
+  std::string kinds;
+  for (auto &kind : kindNames) {
+    if (merged.kinds & kind.first)
+      kinds += std::string(kinds.empty() ? "" : " ") + kind.second;
+  }
+  if (!kinds.empty())
+    name += " [" + kinds + "]";
+  return name;
+}
+
+void Graphs::writeGraphToFile(const cstring &name, const FieldInterner &fields,
+                              EdgeFilter filter) {
+  const auto &edges = edgeView(filter);
+  Graph g;
+  for (size_t v = 0; v < vertexTypes.size(); v++) {
+    auto bv = boost::add_vertex(g);
+    boost::put(&Vertex::name, g, bv, vertexNames[v]);
+    boost::put(&Vertex::type, g, bv, vertexTypes[v]);
+  }
+  for (vertex_t v = 0; v < vertexTypes.size(); v++) {
+    for (auto i = edges.offsets[v]; i < edges.offsets[v + 1]; i++) {
+      auto ep = boost::add_edge(v, edges.targets[i], g);
+      boost::put(&Edge::name, g, ep.first, edgeName(edges.labels[i], fields));
+      boost::put(&Edge::type, g, ep.first, labelType(edges.labels[i]));
+    }
+  }
+
   GraphAttributeSetter()(g);
   auto path = name + ".dot";
   auto out = openFile(path, false);
@@ -127,6 +423,7 @@ void Graphs::writeGraphToFile(const cstring &name) {
     return;
   }
   boost::write_graphviz(*out, g);
+  delete out;
 }
 
 
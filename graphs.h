@@ -31,7 +31,10 @@ limitations under the License.
 
 #include <boost/optional.hpp>
 
+#include <atomic>
+#include <cstdint>
 #include <map>
+#include <unordered_map>
 #include <utility>  // std::pair
 #include <vector>
 
@@ -39,11 +42,35 @@ limitations under the License.
 #include "ir/visitor.h"
 #include "frontends/p4/parserCallGraph.h"
 
+#include "exprSet.h"
+
 namespace multip4 {
 
+typedef enum DependencyType { UseDef, DefUse, DefDef } DependencyType;
+
+// Packed bitset transitive closure of a DAG. Row v holds one bit for every
+// vertex reachable from v through one or more edges.
+class ReachabilityMatrix {
+ public:
+    void reset(size_t numVertices);
+    void set(size_t from, size_t to);
+    void merge(size_t into, size_t from);
+    bool test(size_t from, size_t to) const;
+    size_t bytes() const { return bits.capacity() * sizeof(uint64_t); }
+
+ private:
+    size_t words = 0;
+    std::vector<uint64_t> bits;
+};
+
+// The dependence graph of one control. Vertices and edges are recorded into
+// plain arrays while the control is walked; finalize() then packs the edges
+// into a CSR (compressed sparse row) array that the reachability index and
+// BFS queries run on. The boost graph with its Graphviz attributes is only
+// built by writeGraphToFile.
 class Graphs {
  public:
-    enum class VertexType {
+    enum class VertexType : uint8_t {
         TABLE,
         CONDITION,
         SWITCH,
@@ -51,9 +78,42 @@ class Graphs {
         CONTROL,
         OTHER
     };
-    enum class EdgeType {
+    // STATEFUL edges order two tables whose actions share the state of a
+    // register, counter or meter instance, at least one of them writing it.
+    enum class EdgeType : uint8_t {
       TABLE,
-      ACTION
+      ACTION,
+      STATEFUL
+    };
+    // Kinds of the dependencies merged into one edge by dedupEdges mode.
+    enum EdgeKinds : uint8_t {
+        TableEdge = 1,
+        ActionEdge = 2,
+        UseDefEdge = 4,
+        DefUseEdge = 8,
+        DefDefEdge = 16,
+        StatefulEdge = 32
+    };
+    struct EdgeLabels {
+        uint8_t kinds = 0;
+        ExprSet fields;
+    };
+    // Which edges an EdgeView or a graph export covers. ACTION and STATEFUL
+    // select the edges that carry an action or a stateful dependency.
+    enum class EdgeFilter {
+        ALL,
+        TABLE,
+        ACTION,
+        STATEFUL
+    };
+    // Edges in CSR form: the out-edges of v are
+    // targets/labels[offsets[v]..offsets[v+1]).
+    struct EdgeView {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> targets;
+        std::vector<uint32_t> labels;
+
+        size_t bytes() const;
     };
     struct Vertex {
         cstring name;
@@ -87,17 +147,91 @@ class Graphs {
                                          vertexProperties, edgeProperties,
                                          graphProperties>;
     using Graph = boost::subgraph<Graph_>;
-    using vertex_t = boost::graph_traits<Graph>::vertex_descriptor;
-    using edge_t = boost::graph_traits<Graph>::edge_descriptor;
+    using vertex_t = uint32_t;
+
 
+    // dedupEdges: keep one edge per (from, to) pair, labelled with every
+    // field and dependency kind between the two, instead of one edge per
+    // dependency.
+    explicit Graphs(bool useBfs = false, bool dedupEdges = false)
+        : useBfs(useBfs), dedupEdges(dedupEdges) {}
 
     vertex_t add_vertex(const cstring &name, VertexType type);
-    void add_edge(const vertex_t &from, const vertex_t &to, const cstring &name, EdgeType type);
-    void writeGraphToFile(const cstring &name);
+    // field is an ID of the FieldInterner of the analyzed program.
+    void add_edge(const vertex_t &from, const vertex_t &to, int field, EdgeType type,
+                  DependencyType dependency);
+    void writeGraphToFile(const cstring &name, const FieldInterner &fields,
+                          EdgeFilter filter = EdgeFilter::ALL);
     bool isTableIndependent(const vertex_t &v1, const vertex_t &v2);
     bool isActionIndependent(const vertex_t &v1, const vertex_t &v2);
-    bool isCondition(const vertex_t &v);
-    void deleteActionEdge();
+    bool isCondition(const vertex_t &v) const { return vertexTypes[v] == VertexType::CONDITION; }
+    // Whether a path leads from `from` to `to`; tableOnly follows TABLE
+    // edges only.
+    bool reachable(const vertex_t &from, const vertex_t &to, bool tableOnly);
+    // Packs the recorded edges into the CSR arrays. Adding an edge later
+    // unpacks them again.
+    void finalize();
+    // Builds the CSR arrays, edge views and reachability index up front.
+    // After this, independence queries only read the graph and may run on
+    // several threads.
+    void prepareQueries() { buildViews(); buildReachability(); }
+    // The TABLE, ACTION and STATEFUL views are built once and kept until the
+    // graph changes.
+    const EdgeView& edgeView(EdgeFilter filter);
+    // Makes the next reachability build take row `from` as given instead of
+    // computing it: `all` and `tableOnly` are the vertices reachable through
+    // any edges and through TABLE edges only. Adding an edge drops the
+    // presets.
+    void presetReachability(vertex_t from, std::vector<vertex_t> all,
+                            std::vector<vertex_t> tableOnly);
+    // Rows the last reachability build computed rather than took as preset.
+    size_t reachabilityRowsComputed() const { return rowsComputed; }
+
+    // Longest dependency chains, counted in tables. levelWidths[i] is the
+    // number of tables whose longest chain of predecessors holds i tables.
+    struct PathDepths {
+        unsigned depth = 0;
+        // Following TABLE (match) dependencies only
+        unsigned tableDepth = 0;
+        std::vector<unsigned> levelWidths;
+        // The tables of one longest chain, in order
+        std::vector<vertex_t> criticalTables;
+    };
+    // Empty when the graph has a cycle.
+    PathDepths longestPaths();
+    // Orders the vertices so that every edge points forward. Returns false
+    // if the graph has a cycle.
+    bool topologicalOrder(std::vector<vertex_t> &order);
+    // Longest weighted paths, relaxed along a topological order: an edge of
+    // type `type` out of v weighs weight(v, type). length[v] is the longest
+    // path that ends in v and previous[v] the vertex before v on it, or -1
+    // if no edge leads to v.
+    template <typename Weight>
+    void longestPaths(const std::vector<vertex_t> &order, Weight weight,
+                      std::vector<unsigned> &length, std::vector<int> &previous) {
+        finalize();
+        length.assign(vertexTypes.size(), 0);
+        previous.assign(vertexTypes.size(), -1);
+        for (auto v : order) {
+            for (auto i = allEdges.offsets[v]; i < allEdges.offsets[v + 1]; i++) {
+                auto to = allEdges.targets[i];
+                unsigned candidate = length[v] + weight(v, labelType(allEdges.labels[i]));
+                if (previous[to] < 0 || candidate > length[to]) {
+                    length[to] = candidate;
+                    previous[to] = v;
+                }
+            }
+        }
+    }
+
+    size_t numVertices() const { return vertexTypes.size(); }
+    cstring vertexName(vertex_t v) const { return vertexNames[v]; }
+    VertexType vertexType(vertex_t v) const { return vertexTypes[v]; }
+    size_t numEdges() const { return finalized ? allEdges.targets.size() : edgeList.size(); }
+    // Memory held by the vertex, edge and reachability arrays.
+    size_t bytes() const;
+    // Breadth-first searches run by independence queries so far.
+    uint64_t bfsSearches() const { return bfsCount.load(std::memory_order_relaxed); }
 
     class GraphAttributeSetter {
      public:
@@ -154,6 +288,8 @@ class Graphs {
           switch (type) {
             case EdgeType::TABLE:
               return "solid";
+            case EdgeType::STATEFUL:
+              return "dotted";
             default:
               return "dashed";
           }
@@ -162,8 +298,67 @@ class Graphs {
         }
     };  // end class GraphAttributeSetter
 
- protected:
-    Graph g;
+ private:
+    // An edge's label packs its EdgeType in two bits under either its field
+    // ID or, in dedupEdges mode, its index in mergedLabels. The type of
+    // merged edges is filled in by finalize(): TABLE if any of the merged
+    // dependencies is, else ACTION if any is, else STATEFUL.
+    static uint32_t edgeLabel(uint32_t value, EdgeType type) {
+        return value << 2 | (uint32_t)type;
+    }
+    static EdgeType labelType(uint32_t label) { return (EdgeType)(label & 3); }
+    static bool isTableEdge(uint32_t label) { return labelType(label) == EdgeType::TABLE; }
+    static uint32_t labelValue(uint32_t label) { return label >> 2; }
+    static EdgeType mergedType(uint8_t kinds) {
+        return (kinds & TableEdge) ? EdgeType::TABLE
+               : (kinds & ActionEdge) ? EdgeType::ACTION : EdgeType::STATEFUL;
+    }
+    bool hasActionDependency(uint32_t label) const;
+    bool hasStatefulDependency(uint32_t label) const;
+    cstring edgeName(uint32_t label, const FieldInterner &fields) const;
+
+    struct EdgeRecord {
+        vertex_t from;
+        vertex_t to;
+        uint32_t label;
+    };
+
+    struct PresetRow {
+        vertex_t from;
+        std::vector<vertex_t> all;
+        std::vector<vertex_t> tableOnly;
+    };
+
+    void unfinalize();
+    void buildViews();
+    void buildReachability();
+    bool reaches(vertex_t from, vertex_t to, const EdgeView &edges);
+
+    std::vector<cstring> vertexNames;
+    std::vector<VertexType> vertexTypes;
+    // Edges in insertion order, until finalize() moves them into allEdges.
+    std::vector<EdgeRecord> edgeList;
+    bool finalized = false;
+    EdgeView allEdges;
+    bool viewsValid = false;
+    EdgeView tableEdges;
+    EdgeView actionEdges;
+    EdgeView statefulEdges;
+
+    // Answer independence queries with breadth-first searches instead of the
+    // reachability matrices; kept to cross-check the two implementations.
+    bool useBfs;
+    bool dedupEdges;
+    // dedupEdges mode: the labels of every merged edge, and the index of the
+    // edge of each (from, to) pair.
+    std::vector<EdgeLabels> mergedLabels;
+    std::unordered_map<uint64_t, uint32_t> mergedIndex;
+    bool reachabilityValid = false;
+    ReachabilityMatrix reachAll;
+    ReachabilityMatrix reachTable;
+    std::vector<PresetRow> presetRows;
+    size_t rowsComputed = 0;
+    std::atomic<uint64_t> bfsCount{0};
 };
 
 }  // namespace multip4
@@ -0,0 +1,94 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <set>
+#include <sstream>
+
+#include "frontends/p4/methodInstance.h"
+#include "frontends/p4/toP4/toP4.h"
+
+#include "incremental.h"
+
+namespace multip4 {
+
+  // Bump when the analysis of an unchanged control can change, so that
+  // older state is not reused.
+  static const uint64_t FingerprintVersion = 6;
+
+  ContentHash fingerprintNode(const IR::Node *node) {
+    std::ostringstream text;
+    P4::ToP4 toP4(&text, false);
+    node->apply(toP4);
+    ContentHash hash;
+    hash.add(text.str());
+    return hash;
+  }
+
+  // Collects the declarations outside a control that its analysis depends
+  // on, in the order they are first referenced. Types are collected too:
+  // the widths of key fields decide each table's estimated memory.
+  // fingerprintControl applies this to every collected type as well, so
+  // nested headers and typedefs are found.
+  class ControlDependencies : public Inspector {
+    public:
+      explicit ControlDependencies(P4::ReferenceMap *refMap) : refMap(refMap) {}
+
+      bool preorder(const IR::Type_Name *type) override {
+        add(refMap->getDeclaration(type->path, false));
+        return false;
+      }
+      bool preorder(const IR::PathExpression *path) override {
+        add(refMap->getDeclaration(path->path, false));
+        return false;
+      }
+
+      static bool isFieldType(const IR::IDeclaration *decl) {
+        return decl->is<IR::Type_StructLike>() || decl->is<IR::Type_Typedef>() ||
+          decl->is<IR::Type_Newtype>() || decl->is<IR::Type_Enum>() ||
+          decl->is<IR::Type_SerEnum>();
+      }
+
+      std::vector<const IR::IDeclaration*> declarations;
+
+    private:
+      void add(const IR::IDeclaration *decl) {
+        //Extern signatures give the directions of call arguments; applied
+        //controls contribute their tables; header, struct and typedef
+        //declarations give field widths; top-level register, counter and
+        //meter instances name the state fields
+        if (decl == nullptr || !(decl->is<IR::P4Control>() || decl->is<IR::Type_Extern>() ||
+              decl->is<IR::Method>() || decl->is<IR::Declaration_Instance>() ||
+              isFieldType(decl)))
+          return;
+        if (seen.insert(decl).second)
+          declarations.push_back(decl);
+      }
+
+      P4::ReferenceMap *refMap;
+      std::set<const IR::IDeclaration*> seen;
+  };
+
+  ContentHash fingerprintControl(const IR::P4Control *control, P4::ReferenceMap *refMap) {
+    ContentHash hash = fingerprintNode(control);
+    hash.add(FingerprintVersion);
+    ControlDependencies dependencies(refMap);
+    control->apply(dependencies);
+    //The list grows as the types and instances name further types
+    for (size_t i = 0; i < dependencies.declarations.size(); i++) {
+      auto decl = dependencies.declarations[i];
+      if (ControlDependencies::isFieldType(decl) || decl->is<IR::Declaration_Instance>())
+        decl->getNode()->apply(dependencies);
+    }
+    for (auto decl : dependencies.declarations) {
+      if (decl == control)
+        continue;
+      auto sub = decl->to<IR::P4Control>();
+      auto part = sub != nullptr ? fingerprintControl(sub, refMap)
+        : fingerprintNode(decl->getNode());
+      hash.add(part.lo).add(part.hi);
+    }
+    return hash;
+  }
+
+} //namespace multip4
@@ -0,0 +1,51 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_INCREMENTAL_H
+#define MULTIP4_INCREMENTAL_H
+
+#include <vector>
+
+#include "ir/ir.h"
+
+#include "contentHash.h"
+
+namespace P4 {
+  class ReferenceMap;
+
+} //namespace P4
+
+namespace multip4 {
+
+  // Incremental analysis (Options::incrementalDir) keeps the .mp4g image of
+  // every control in a state directory, together with fingerprints of the
+  // control and its actions. On the next run a control whose fingerprint is
+  // unchanged is restored from that image without walking its IR. A changed
+  // control is walked again, but the reachability rows of the tables whose
+  // downstream dependencies are the same as before are copied from the
+  // image instead of being recomputed.
+  //
+  // What one incremental run did, for editor plugins and watch loops.
+  struct IncrementalResult {
+    std::vector<cstring> reusedControls;
+    std::vector<cstring> reanalyzedControls;
+    // control.action for every table action that is new or whose IR changed
+    std::vector<cstring> changedActions;
+    // Table reachability rows copied from the state / computed again
+    size_t rowsReused = 0;
+    size_t rowsComputed = 0;
+  };
+
+  // Hash of the P4 source of node, as printed back by ToP4.
+  ContentHash fingerprintNode(const IR::Node *node);
+
+  // Hash of a top-level control: its own source, the externs it calls, the
+  // types of its fields, the top-level extern instances it uses and,
+  // recursively, the controls it applies, whose tables are analyzed as part
+  // of it.
+  ContentHash fingerprintControl(const IR::P4Control *control, P4::ReferenceMap *refMap);
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,144 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <sys/resource.h>
+
+#include <cstdio>
+
+#include "instrumentation.h"
+
+namespace multip4 {
+
+  void Metrics::addTime(cstring phase, double seconds) {
+    for (auto &t : phaseTimes) {
+      if (t.first == phase) {
+        t.second += seconds;
+        return;
+      }
+    }
+    phaseTimes.emplace_back(phase, seconds);
+  }
+
+  double Metrics::time(cstring phase) const {
+    for (auto &t : phaseTimes) {
+      if (t.first == phase)
+        return t.second;
+    }
+    return 0;
+  }
+
+  void Metrics::add(cstring counter, uint64_t n) {
+    for (auto &c : counters) {
+      if (c.first == counter) {
+        c.second += n;
+        return;
+      }
+    }
+    counters.emplace_back(counter, n);
+  }
+
+  void Metrics::set(cstring counter, uint64_t value) {
+    for (auto &c : counters) {
+      if (c.first == counter) {
+        c.second = value;
+        return;
+      }
+    }
+    counters.emplace_back(counter, value);
+  }
+
+  uint64_t Metrics::get(cstring counter) const {
+    for (auto &c : counters) {
+      if (c.first == counter)
+        return c.second;
+    }
+    return 0;
+  }
+
+  Metrics* Metrics::addControl(cstring controlName) {
+    controls.emplace_back(new Metrics(controlName));
+    return controls.back().get();
+  }
+
+  void Metrics::writeJson(std::ostream &out) const {
+    out << "{\"name\": ";
+    writeJsonString(out, name);
+    out << ", \"times\": {";
+    const char *sep = "";
+    for (auto &t : phaseTimes) {
+      out << sep;
+      writeJsonString(out, t.first);
+      out << ": " << t.second;
+      sep = ", ";
+    }
+    out << "}, \"counters\": {";
+    sep = "";
+    for (auto &c : counters) {
+      out << sep;
+      writeJsonString(out, c.first);
+      out << ": " << c.second;
+      sep = ", ";
+    }
+    out << "}, \"controls\": [";
+    sep = "";
+    for (auto &c : controls) {
+      out << sep;
+      c->writeJson(out);
+      sep = ", ";
+    }
+    out << "]}";
+  }
+
+  ScopedTimer::ScopedTimer(Metrics *metrics, cstring phase)
+    : metrics(metrics), phase(phase) {
+    if (metrics != nullptr)
+      start = std::chrono::steady_clock::now();
+  }
+
+  ScopedTimer::~ScopedTimer() {
+    if (metrics != nullptr) {
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      metrics->addTime(phase, elapsed.count());
+    }
+  }
+
+  void appendJsonString(std::string &out, cstring s) {
+    if (s == nullptr) {
+      out += "null";
+      return;
+    }
+    out += '"';
+    for (const char *p = s.c_str(); *p; p++) {
+      switch (*p) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+          if ((unsigned char)*p < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", *p);
+            out += buf;
+          } else {
+            out += *p;
+          }
+      }
+    }
+    out += '"';
+  }
+
+  void writeJsonString(std::ostream &out, cstring s) {
+    std::string quoted;
+    appendJsonString(quoted, s);
+    out << quoted;
+  }
+
+  uint64_t peakRssKb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+    return usage.ru_maxrss;
+  }
+
+} //namespace multip4
@@ -0,0 +1,76 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_INSTRUMENTATION_H
+#define MULTIP4_INSTRUMENTATION_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib/cstring.h"
+
+namespace multip4 {
+
+  // Wall-clock seconds spent in each phase of one analysis, plus named
+  // counters. Phases and counters keep the order in which they first
+  // appeared; a phase that runs again accumulates. A file's metrics hold one
+  // child per top-level control.
+  class Metrics {
+    public:
+      explicit Metrics(cstring name = nullptr) : name(name) {}
+
+      void addTime(cstring phase, double seconds);
+      double time(cstring phase) const;
+      const std::vector<std::pair<cstring, double>>& times() const { return phaseTimes; }
+
+      void add(cstring counter, uint64_t n = 1);
+      void set(cstring counter, uint64_t value);
+      uint64_t get(cstring counter) const;
+      const std::vector<std::pair<cstring, uint64_t>>& allCounters() const { return counters; }
+
+      // The returned object lives as long as this one. Create controls before
+      // handing them to other threads; each control may then be updated by
+      // one thread without locking.
+      Metrics* addControl(cstring controlName);
+      const std::vector<std::unique_ptr<Metrics>>& allControls() const { return controls; }
+      cstring getName() const { return name; }
+
+      // {"name": ..., "times": {...}, "counters": {...}, "controls": [...]}
+      void writeJson(std::ostream &out) const;
+
+    private:
+      cstring name;
+      std::vector<std::pair<cstring, double>> phaseTimes;
+      std::vector<std::pair<cstring, uint64_t>> counters;
+      std::vector<std::unique_ptr<Metrics>> controls;
+  };
+
+  // Adds its own lifetime to a phase of `metrics`. Does nothing when metrics
+  // is null, so timers can stay in place when no one asked for them.
+  class ScopedTimer {
+    public:
+      ScopedTimer(Metrics *metrics, cstring phase);
+      ~ScopedTimer();
+
+    private:
+      Metrics *metrics;
+      cstring phase;
+      std::chrono::steady_clock::time_point start;
+  };
+
+  // Writes / appends s as a quoted JSON string.
+  void writeJsonString(std::ostream &out, cstring s);
+  void appendJsonString(std::string &out, cstring s);
+
+  // Peak resident set size of this process so far, in kilobytes.
+  uint64_t peakRssKb();
+
+} //namespace multip4
+
+#endif
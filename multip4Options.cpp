@@ -0,0 +1,156 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <cerrno>
+#include <cstdlib>
+
+#include "lib/error.h"
+
+#include "multip4Options.h"
+
+namespace multip4 {
+
+  static bool parseCount(const char *option, const char *arg, unsigned &value) {
+    int n = atoi(arg);
+    if (n < 1) {
+      ::error("%1% expects a positive number, got %2%", option, arg);
+      return false;
+    }
+    value = n;
+    return true;
+  }
+
+  static bool parseAmount(const char *option, const char *arg, uint64_t &value) {
+    char *end;
+    errno = 0;
+    value = strtoull(arg, &end, 10);
+    if (*arg == '\0' || *arg == '-' || *end != '\0' || errno != 0) {
+      ::error("%1% expects a number, got %2%", option, arg);
+      return false;
+    }
+    return true;
+  }
+
+  static bool parseAmount(const char *option, const char *arg, unsigned &value) {
+    uint64_t n;
+    if (!parseAmount(option, arg, n))
+      return false;
+    value = n;
+    return true;
+  }
+
+  Options::Options() {
+    registerOption("--bfs-independence", nullptr,
+        [this](const char *) { useBfs = true; return true; },
+        "Answer table independence queries with BFS instead of\n"
+        "the precomputed reachability index (for cross-checking)");
+    registerOption("--dedup-edges", nullptr,
+        [this](const char *) { dedupEdges = true; return true; },
+        "Draw one dependence edge per pair of tables, labelled with\n"
+        "every field that the two depend on");
+    registerOption("--first-apply-only", nullptr,
+        [this](const char *) { firstApplyOnly = true; return true; },
+        "Analyze a table or sub-control only where it is first applied,\n"
+        "reproducing the results of earlier releases");
+    registerOption("--batch", "file|dir",
+        [this](const char *arg) { batchInput = arg; return true; },
+        "Analyze every *.p4 file in a directory, or every file listed\n"
+        "(one per line) in a file, inside a single process");
+    registerOption("-j", "N",
+        [this](const char *arg) { return parseCount("-j", arg, jobs); },
+        "Analyze --batch inputs with N worker processes");
+    registerOption("--control-threads", "N",
+        [this](const char *arg) { return parseCount("--control-threads", arg, controlThreads); },
+        "Finish the analysis of up to N top-level controls at the same time");
+    registerOption("--pair-threads", "N",
+        [this](const char *arg) { return parseCount("--pair-threads", arg, pairThreads); },
+        "Count independent table pairs of a control on N threads");
+    registerOption("--pair-matrix", "dir",
+        [this](const char *arg) { pairMatrixDir = arg; return true; },
+        "Write the table independence matrix of every control to\n"
+        "dir/<file>.<control>.csv");
+    registerOption("--graph-dir", "dir",
+        [this](const char *arg) { graphDir = arg; return true; },
+        "Write the dependence graph of every control to\n"
+        "dir/<file>.<control>.dot");
+    registerOption("--analysis-dir", "dir",
+        [this](const char *arg) { analysisDir = arg; return true; },
+        "Write the analysis of every control in the binary .mp4g format to\n"
+        "dir/<file>.<control>.mp4g");
+    registerOption("--graph-edges", "all|table|action|stateful",
+        [this](const char *arg) {
+          graphEdges = arg;
+          if (graphEdges != "all" && graphEdges != "table" && graphEdges != "action" &&
+              graphEdges != "stateful") {
+            ::error("--graph-edges expects all, table, action or stateful, got %1%", arg);
+            return false;
+          }
+          return true; },
+        "Draw only the edges with a table (match) dependency, only those with\n"
+        "an action dependency, or only those on the state of a register,\n"
+        "counter or meter, in --graph-dir graphs");
+    registerOption("--cache-dir", "dir",
+        [this](const char *arg) { cacheDir = arg; return true; },
+        "Reuse the outputs of earlier runs on the same preprocessed source\n"
+        "and options, stored in dir (default $MULTIP4_CACHE_DIR)");
+    registerOption("--no-cache", nullptr,
+        [this](const char *) { noCache = true; return true; },
+        "Always analyze, ignoring --cache-dir and $MULTIP4_CACHE_DIR");
+    registerOption("--incremental", "dir",
+        [this](const char *arg) { incrementalDir = arg; return true; },
+        "Keep the analysis of every control in dir and, on the next run,\n"
+        "reuse it for the controls and reachability rows an edit left alone");
+    registerOption("--serve", "socket|-",
+        [this](const char *arg) { serveAddress = arg; return true; },
+        "Stay running and answer JSON analysis requests, one per line, on\n"
+        "a UNIX socket or on stdin / stdout (-)");
+    registerOption("--pack-stages", nullptr,
+        [this](const char *) { packStages = true; return true; },
+        "Assign the tables of every control to pipeline stages and report\n"
+        "the stage count and critical path with the --results records");
+    registerOption("--match-gap", "N",
+        [this](const char *arg) { return parseAmount("--match-gap", arg, matchGap); },
+        "Stages between tables with a match dependency (default 2)");
+    registerOption("--action-gap", "N",
+        [this](const char *arg) { return parseAmount("--action-gap", arg, actionGap); },
+        "Stages between tables with only an action or stateful dependency\n"
+        "(default 1)");
+    registerOption("--stage-tables", "N",
+        [this](const char *arg) { return parseAmount("--stage-tables", arg, stageTables); },
+        "Tables one stage can hold (default no limit)");
+    registerOption("--stage-memory", "bytes",
+        [this](const char *arg) { return parseAmount("--stage-memory", arg, stageMemory); },
+        "Match memory of one stage (default no limit)");
+    registerOption("--stats-json", "file",
+        [this](const char *arg) { statsJson = arg; return true; },
+        "Write one JSON line per analyzed file to file, with phase\n"
+        "times and counters for the file and each of its controls");
+    registerOption("--results", "file",
+        [this](const char *arg) { resultsFile = arg; return true; },
+        "Write analysis records to file (- for stdout); see\n"
+        "--results-format and --results-detail");
+    registerOption("--results-format", "csv|ndjson",
+        [this](const char *arg) {
+          resultsFormat = arg;
+          if (resultsFormat != "csv" && resultsFormat != "ndjson") {
+            ::error("--results-format expects csv or ndjson, got %1%", arg);
+            return false;
+          }
+          return true; },
+        "Format of the --results records (default csv)");
+    registerOption("--results-detail", "stats|tables|dependencies|pairs",
+        [this](const char *arg) {
+          resultsDetail = arg;
+          if (resultsDetail != "stats" && resultsDetail != "tables" &&
+              resultsDetail != "dependencies" && resultsDetail != "pairs") {
+            ::error("--results-detail expects stats, tables, dependencies or pairs, got %1%",
+                arg);
+            return false;
+          }
+          return true; },
+        "Records written to --results; each level includes the ones\n"
+        "before it (default stats)");
+  }
+
+} //namespace multip4
@@ -0,0 +1,56 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_OPTIONS_H
+#define MULTIP4_OPTIONS_H
+
+#include "frontends/common/options.h"
+
+namespace multip4 {
+
+  class Options : public CompilerOptions {
+    public:
+      bool useBfs = false;
+      bool dedupEdges = false;
+      // Analyze only the first apply of a table or sub-control, as releases
+      // before the per-apply-site analysis did
+      bool firstApplyOnly = false;
+      cstring batchInput = nullptr;
+      unsigned jobs = 1;
+      unsigned controlThreads = 1;
+      unsigned pairThreads = 1;
+      cstring pairMatrixDir = nullptr;
+      cstring graphDir = nullptr;
+      cstring analysisDir = nullptr;
+      // all, table, action or stateful: which dependence edges --graph-dir
+      // draws
+      cstring graphEdges = "all";
+      cstring statsJson = nullptr;
+      // Structured results: destination (- for stdout), csv or ndjson, and
+      // stats, tables, dependencies or pairs
+      cstring resultsFile = nullptr;
+      cstring resultsFormat = "csv";
+      cstring resultsDetail = "stats";
+      cstring cacheDir = nullptr;
+      bool noCache = false;
+      // Where incremental runs keep the analysis of each control between
+      // runs (see incremental.h)
+      cstring incrementalDir = nullptr;
+      // UNIX socket path, or - for stdin / stdout (see server.h)
+      cstring serveAddress = nullptr;
+      // Stage packing (see stagePacker.h); 0 budgets are unlimited
+      bool packStages = false;
+      unsigned matchGap = 2;
+      unsigned actionGap = 1;
+      unsigned stageTables = 0;
+      uint64_t stageMemory = 0;
+
+      Options();
+  };
+
+  using Multip4Context = P4CContextWithOptions<Options>;
+
+} //namespace multip4
+
+#endif
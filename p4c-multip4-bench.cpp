@@ -0,0 +1,277 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ir/ir.h"
+#include "lib/error.h"
+#include "lib/gc.h"
+#include "lib/crash.h"
+
+#include "driver.h"
+#include "instrumentation.h"
+#include "pipelineGenerator.h"
+#include "tableAnalyzer.h"
+
+namespace {
+
+  const char *phases[] = {
+    "parse", "frontend", "midend", "buildGraphs", "findIndependentTables", "writeGraphs"
+  };
+
+  struct BenchConfig {
+    multip4::PipelineShape shape;
+    std::vector<unsigned> tableCounts = {16, 32, 64, 128, 256};
+    unsigned repeat = 3;
+    bool json = false;
+    std::string workDir = ".";
+    // Sizes for the findId micro-benchmark; when set, only it runs.
+    std::vector<unsigned> findIdSizes;
+  };
+
+  std::vector<unsigned> parseList(const char *arg) {
+    std::vector<unsigned> values;
+    std::stringstream list(arg);
+    std::string item;
+    while (std::getline(list, item, ','))
+      values.push_back(atoi(item.c_str()));
+    return values;
+  }
+
+  // Takes the benchmark options out of argv; everything else is left for
+  // the compiler options (e.g. -I for the p4include directory).
+  bool parseBenchArgs(int argc, char *const argv[], BenchConfig &config,
+      std::vector<char*> &rest) {
+    rest.push_back(argv[0]);
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (arg == "--tables" && hasValue) {
+        config.tableCounts = parseList(argv[++i]);
+      } else if (arg == "--actions" && hasValue) {
+        config.shape.actionsPerTable = atoi(argv[++i]);
+      } else if (arg == "--fields" && hasValue) {
+        config.shape.fieldsPerAction = atoi(argv[++i]);
+      } else if (arg == "--depth" && hasValue) {
+        config.shape.nestingDepth = atoi(argv[++i]);
+      } else if (arg == "--density" && hasValue) {
+        config.shape.dependencyDensity = atof(argv[++i]);
+      } else if (arg == "--seed" && hasValue) {
+        config.shape.seed = atoi(argv[++i]);
+      } else if (arg == "--repeat" && hasValue) {
+        config.repeat = atoi(argv[++i]);
+      } else if (arg == "--format" && hasValue) {
+        std::string format = argv[++i];
+        if (format != "csv" && format != "json") {
+          ::error("--format expects csv or json, got %1%", format);
+          return false;
+        }
+        config.json = format == "json";
+      } else if (arg == "--work-dir" && hasValue) {
+        config.workDir = argv[++i];
+      } else if (arg == "--find-id" && hasValue) {
+        config.findIdSizes = parseList(argv[++i]);
+      } else {
+        rest.push_back(argv[i]);
+      }
+    }
+    return true;
+  }
+
+  void printRow(const BenchConfig &config, unsigned run, bool ok,
+      const multip4::Metrics &metrics, bool first) {
+    const auto &shape = config.shape;
+    double total = 0;
+    for (auto phase : phases)
+      total += metrics.time(phase);
+
+    if (config.json) {
+      std::cout << (first ? "[\n" : ",\n") << "  {\"tables\": " << shape.tables
+        << ", \"actions\": " << shape.actionsPerTable << ", \"fields\": " << shape.fieldsPerAction
+        << ", \"depth\": " << shape.nestingDepth << ", \"density\": " << shape.dependencyDensity
+        << ", \"run\": " << run << ", \"ok\": " << (ok ? "true" : "false");
+      for (auto phase : phases)
+        std::cout << ", \"" << phase << "\": " << metrics.time(phase);
+      std::cout << ", \"total\": " << total << "}";
+      return;
+    }
+
+    if (first) {
+      std::cout << "tables,actions,fields,depth,density,run,ok";
+      for (auto phase : phases)
+        std::cout << "," << phase;
+      std::cout << ",total\n";
+    }
+    std::cout << shape.tables << "," << shape.actionsPerTable << "," << shape.fieldsPerAction
+      << "," << shape.nestingDepth << "," << shape.dependencyDensity << "," << run << ","
+      << (ok ? 1 : 0);
+    for (auto phase : phases)
+      std::cout << "," << metrics.time(phase);
+    std::cout << "," << total << "\n";
+  }
+
+  // The recursive findId that TableAnalyzer::collectIds replaced, kept to
+  // measure against: every level of a list copies the remaining components
+  // into a new ListExpression, and every level merges a fresh set.
+  multip4::ExprSet legacyFindId(const IR::Expression *expr, multip4::FieldInterner &fields) {
+    if (expr->is<IR::ListExpression>()) {
+      auto exprList = expr->to<IR::ListExpression>()->components;
+      if (exprList.empty())
+        return {};
+      auto lastExpr = exprList.back();
+      exprList.pop_back();
+      const IR::Expression *rest = new IR::ListExpression(exprList);
+      multip4::ExprSet result = legacyFindId(lastExpr, fields);
+      result |= legacyFindId(rest, fields);
+      return result;
+    }
+    if (auto bexpr = expr->to<IR::Operation_Binary>()) {
+      multip4::ExprSet result = legacyFindId(bexpr->left, fields);
+      result |= legacyFindId(bexpr->right, fields);
+      return result;
+    }
+    if (auto texpr = expr->to<IR::Operation_Ternary>()) {
+      multip4::ExprSet result = legacyFindId(texpr->e0, fields);
+      result |= legacyFindId(texpr->e1, fields);
+      result |= legacyFindId(texpr->e2, fields);
+      return result;
+    }
+    if (auto m = expr->to<IR::Member>()) {
+      multip4::ExprSet result;
+      if (!m->expr->is<IR::TypeNameExpression>())
+        result.insert(fields.intern(expr->toString()));
+      return result;
+    }
+    if (auto uexpr = expr->to<IR::Operation_Unary>())
+      return legacyFindId(uexpr->expr, fields);
+    multip4::ExprSet result;
+    if (expr->is<IR::AttribLocal>())
+      result.insert(fields.intern(expr->toString()));
+    return result;
+  }
+
+  const IR::Expression *benchField(unsigned i) {
+    return new IR::Member(new IR::PathExpression(IR::ID("hdr")),
+        IR::ID(cstring("f" + std::to_string(i))));
+  }
+
+  // A key list of `size` fields, or a sum nested `size` levels deep.
+  const IR::Expression *findIdInput(const std::string &shape, unsigned size) {
+    if (shape == "list") {
+      IR::Vector<IR::Expression> components;
+      for (unsigned i = 0; i < size; i++)
+        components.push_back(benchField(i));
+      return new IR::ListExpression(components);
+    }
+    const IR::Expression *sum = benchField(0);
+    for (unsigned i = 1; i < size; i++)
+      sum = new IR::Add(sum, benchField(i));
+    return sum;
+  }
+
+  // Keeps the timed calls from being optimized away
+  volatile size_t findIdSink;
+
+  template <typename Find>
+  double microsecondsPerCall(unsigned calls, Find find) {
+    auto start = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (unsigned c = 0; c < calls; c++)
+      found += find().size();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    findIdSink = found;
+    return elapsed.count() / calls;
+  }
+
+  // Times the legacy and the current findId on the same expressions.
+  void runFindIdBench(const BenchConfig &config) {
+    multip4::TableAnalyzer analyzer(nullptr, nullptr, multip4::Multip4Context::get().options(),
+        std::cout);
+    multip4::FieldInterner legacyFields;
+    bool first = true;
+    if (!config.json)
+      std::cout << "shape,size,run,legacy,current,speedup\n";
+    for (auto shape : {"list", "nested"}) {
+      for (auto size : config.findIdSizes) {
+        auto expr = findIdInput(shape, size);
+        unsigned calls = std::max(1u, 20000 / std::max(1u, size));
+        for (unsigned run = 0; run < config.repeat; run++) {
+          double legacy = microsecondsPerCall(calls,
+              [&]() { return legacyFindId(expr, legacyFields); });
+          double current = microsecondsPerCall(calls, [&]() { return analyzer.findId(expr); });
+          double speedup = current > 0 ? legacy / current : 0;
+          if (config.json) {
+            std::cout << (first ? "[\n" : ",\n") << "  {\"shape\": \"" << shape
+              << "\", \"size\": " << size << ", \"run\": " << run << ", \"legacy\": "
+              << legacy << ", \"current\": " << current << ", \"speedup\": " << speedup << "}";
+          } else {
+            std::cout << shape << "," << size << "," << run << "," << legacy << "," << current
+              << "," << speedup << "\n";
+          }
+          first = false;
+        }
+      }
+    }
+    if (config.json && !first)
+      std::cout << "\n]\n";
+  }
+
+}  // namespace
+
+// Times every analysis phase on synthetic programs of growing size.
+//   p4c-multip4-bench --tables 16,64,256 --actions 2 --fields 4 --depth 2
+//       --density 0.3 --repeat 3 --format csv -I<p4c>/p4include
+// or, with --find-id 16,256,4096, compares the old recursive findId with
+// the current one on key lists and nested expressions of those sizes.
+int main(int argc, char *const argv[]) {
+  setup_gc_logging();
+  setup_signals();
+
+  AutoCompileContext autoMultip4Context(new ::multip4::Multip4Context);
+  auto& options = ::multip4::Multip4Context::get().options();
+  options.langVersion = CompilerOptions::FrontendVersion::P4_16;
+  options.compilerVersion = "0.0.1";
+
+  BenchConfig config;
+  std::vector<char*> rest;
+  if (!parseBenchArgs(argc, argv, config, rest))
+    return 1;
+  options.process((int)rest.size(), rest.data());
+  if (::errorCount() > 0)
+    return 1;
+  if (!config.findIdSizes.empty()) {
+    runFindIdBench(config);
+    return 0;
+  }
+  options.graphDir = config.workDir;
+
+  bool first = true;
+  unsigned failed = 0;
+  for (auto tables : config.tableCounts) {
+    config.shape.tables = tables;
+    auto path = config.workDir + "/bench-" + std::to_string(tables) + ".p4";
+    std::ofstream(path) << multip4::generatePipeline(config.shape);
+
+    for (unsigned run = 0; run < config.repeat; run++) {
+      multip4::Metrics metrics;
+      std::ostringstream stats;
+      bool ok = multip4::analyzeInNewContext(path, stats, &metrics);
+      if (!ok)
+        failed++;
+      printRow(config, run, ok, metrics, first);
+      first = false;
+    }
+  }
+  if (config.json && !first)
+    std::cout << "\n]\n";
+
+  return failed > 0;
+}
@@ -9,45 +9,9 @@ Written by Seungbin Song
 #include "lib/gc.h"
 #include "lib/crash.h"
 #include "lib/nullstream.h"
-#include "frontends/common/applyOptionsPragmas.h"
-#include "frontends/common/parseInput.h"
-#include "frontends/p4/evaluator/evaluator.h"
-#include "frontends/p4/frontend.h"
 
-#include "tableAnalyzer.h"
-
-namespace multip4 {
-  
-  class Options : public CompilerOptions {};
-
-  using Multip4Context = P4CContextWithOptions<Options>;
-
-  class MidEnd : public PassManager {
-    public:
-      P4::ReferenceMap    refMap;
-      P4::TypeMap         typeMap;
-      IR::ToplevelBlock   *toplevel = nullptr;
-
-      explicit MidEnd(CompilerOptions& options);
-      IR::ToplevelBlock* process(const IR::P4Program *&program) {
-          program = program->apply(*this);
-          return toplevel;
-      }
-  };
-
-  MidEnd::MidEnd(CompilerOptions& options) {
-    bool isv1 = options.langVersion == CompilerOptions::FrontendVersion::P4_14;
-    refMap.setIsV1(isv1);
-    auto evaluator = new P4::EvaluatorPass(&refMap, &typeMap);
-    setName("MidEnd");
-
-    addPasses({
-        evaluator,
-        new VisitFunctor([this, evaluator]() { toplevel = evaluator->getToplevelBlock(); }),
-    });
-  } 
-
-} //namespace multip4
+#include "driver.h"
+#include "server.h"
 
 int main(int argc, char *const argv[]) {
 	setup_gc_logging();
@@ -58,49 +22,50 @@ int main(int argc, char *const argv[]) {
   options.langVersion = CompilerOptions::FrontendVersion::P4_16;
   options.compilerVersion = "0.0.1";
 
-  if (options.process(argc, argv) != nullptr)
+  if (options.process(argc, argv) != nullptr && options.batchInput == nullptr &&
+      options.serveAddress == nullptr)
     options.setInputFile();
   if(::errorCount() > 0)
     return 1;
 
-  auto hook = options.getDebugHook();
-
-  auto program = P4::parseP4File(options);
-  if (program == nullptr || ::errorCount() > 0)
-    return 1;
-
-  try {
-    P4::P4COptionPragmaParser optionsPragmaParser;
-    program->apply(P4::ApplyOptionsPragmas(optionsPragmaParser));
+  if (options.serveAddress != nullptr)
+    return multip4::serve(options.serveAddress);
 
-    P4::FrontEnd fe;
-    fe.addDebugHook(hook);
-    program = fe.run(options, program);
-  } catch (const Util::P4CExceptionBase &bug) {
-    std::cerr << bug.what() << std::endl;
-    return 1;
+  std::ostream *statsJson = nullptr;
+  if (options.statsJson != nullptr) {
+    statsJson = openFile(options.statsJson, false);
+    if (statsJson == nullptr) {
+      ::error("Failed to open file %1%", options.statsJson);
+      return 1;
+    }
   }
-  if (program == nullptr || ::errorCount() > 0)
-    return 1;
 
-  multip4::MidEnd midEnd(options);
-  midEnd.addDebugHook(hook);
-  const IR::ToplevelBlock *top = nullptr;
-  try {
-    top = midEnd.process(program);
-    if (options.dumpJsonFile)
-        JSONGenerator(*openFile(options.dumpJsonFile, true)) << program << std::endl;
-  } catch (const Util::P4CExceptionBase &bug) {
-    std::cerr << bug.what() << std::endl;
-    return 1;
+  std::ostream *resultsOut = nullptr;
+  multip4::ResultWriter *results = nullptr;
+  if (options.resultsFile != nullptr) {
+    resultsOut = options.resultsFile == "-" ? &std::cout : openFile(options.resultsFile, false);
+    if (resultsOut == nullptr) {
+      ::error("Failed to open file %1%", options.resultsFile);
+      return 1;
+    }
+    results = new multip4::ResultWriter(*resultsOut, options);
   }
-  if (::errorCount() > 0)
-    return 1;
 
-  //std::cout << "Generating match-action dependency graphs" << std::endl;
-  multip4::TableAnalyzer ta(&midEnd.refMap, &midEnd.typeMap, options.file);
-  top->getMain()->apply(ta);
-
-  return ::errorCount() > 0;
+  int status;
+  if (options.batchInput != nullptr) {
+    auto files = multip4::readBatchInputs(options.batchInput);
+    if (::errorCount() > 0)
+      return 1;
+    status = multip4::analyzeParallel(files, options.jobs, std::cout, statsJson, results) > 0;
+  } else if (statsJson != nullptr) {
+    status = multip4::analyzeBatch({options.file}, std::cout, statsJson, results) > 0;
+  } else {
+    status = !multip4::analyzeFile(std::cout, nullptr, results);
+  }
+  delete statsJson;
+  delete results;
+  if (resultsOut != &std::cout)
+    delete resultsOut;
+  return status;
 
 }
@@ -0,0 +1,82 @@
+/*
+Written by Seungbin Song
+*/
+
+#include "config.h"
+
+#if HAVE_LIBGC
+#define GC_THREADS
+#include <gc/gc.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+namespace multip4 {
+
+  // Worker threads allocate (containers use the GC-backed operator new), so
+  // the collector has to know about them and scan their stacks.
+  class GCThreadScope {
+    public:
+      GCThreadScope() {
+#if HAVE_LIBGC
+        struct GC_stack_base sb;
+        registered = GC_get_stack_base(&sb) == GC_SUCCESS &&
+          GC_register_my_thread(&sb) == GC_SUCCESS;
+#endif
+      }
+      ~GCThreadScope() {
+#if HAVE_LIBGC
+        if (registered)
+          GC_unregister_my_thread();
+#endif
+      }
+
+    private:
+      bool registered = false;
+  };
+
+  void parallelFor(size_t n, unsigned threads, const std::function<void(size_t)> &body) {
+    if (threads <= 1 || n <= 1) {
+      for (size_t i = 0; i < n; i++)
+        body(i);
+      return;
+    }
+
+#if HAVE_LIBGC
+    GC_allow_register_threads();
+#endif
+    std::atomic<size_t> next(0);
+    std::exception_ptr failure;
+    std::mutex failureLock;
+    auto worker = [&]() {
+      GCThreadScope gcScope;
+      for (size_t i = next++; i < n; i = next++) {
+        try {
+          body(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> guard(failureLock);
+          if (!failure)
+            failure = std::current_exception();
+        }
+      }
+    };
+
+    std::vector<std::thread> pool;
+    unsigned count = (unsigned)std::min<size_t>(threads, n);
+    for (unsigned t = 1; t < count; t++)
+      pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+      t.join();
+    if (failure)
+      std::rethrow_exception(failure);
+  }
+
+} //namespace multip4
@@ -0,0 +1,23 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_PARALLEL_H
+#define MULTIP4_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+namespace multip4 {
+
+  // Runs body(i) for every i in [0, n) on up to `threads` threads. Indices
+  // are claimed one at a time, so items of uneven cost still balance. With
+  // one thread, or one item, body runs inline on the calling thread.
+  //
+  // body must not touch IR, the ReferenceMap/TypeMap or the error reporter:
+  // none of them are safe to use from several threads.
+  void parallelFor(size_t n, unsigned threads, const std::function<void(size_t)> &body);
+
+} //namespace multip4
+
+#endif
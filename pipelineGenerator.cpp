@@ -0,0 +1,143 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "pipelineGenerator.h"
+
+namespace multip4 {
+
+  namespace {
+
+    class Generator {
+      public:
+        explicit Generator(const PipelineShape &shape) : shape(shape), rng(shape.seed) {}
+
+        std::string run() {
+          std::ostringstream actions;
+          for (unsigned t = 0; t < shape.tables; t++)
+            emitTable(actions, t);
+
+          std::ostringstream apply;
+          emitBlock(apply, 0, shape.tables, shape.nestingDepth, "        ");
+
+          std::ostringstream out;
+          out << "#include <core.p4>\n#include <v1model.p4>\n\n";
+          out << "header data_t {\n    bit<32> f;\n}\n\n";
+          out << "struct headers_t {\n    data_t data;\n}\n\n";
+          out << "struct metadata_t {\n";
+          for (unsigned f = 0; f < numFields; f++)
+            out << "    bit<32> m" << f << ";\n";
+          out << "}\n\n";
+          out << "parser ParserImpl(packet_in packet, out headers_t hdr, inout metadata_t meta,\n"
+                 "                  inout standard_metadata_t standard_metadata) {\n"
+                 "    state start {\n        packet.extract(hdr.data);\n"
+                 "        transition accept;\n    }\n}\n\n";
+          out << "control VerifyChecksumImpl(inout headers_t hdr, inout metadata_t meta) {\n"
+                 "    apply { }\n}\n\n";
+          out << "control IngressImpl(inout headers_t hdr, inout metadata_t meta,\n"
+                 "                    inout standard_metadata_t standard_metadata) {\n";
+          out << actions.str();
+          out << "    apply {\n" << apply.str() << "    }\n}\n\n";
+          out << "control EgressImpl(inout headers_t hdr, inout metadata_t meta,\n"
+                 "                   inout standard_metadata_t standard_metadata) {\n"
+                 "    apply { }\n}\n\n";
+          out << "control ComputeChecksumImpl(inout headers_t hdr, inout metadata_t meta) {\n"
+                 "    apply { }\n}\n\n";
+          out << "control DeparserImpl(packet_out packet, in headers_t hdr) {\n"
+                 "    apply {\n        packet.emit(hdr.data);\n    }\n}\n\n";
+          out << "V1Switch(ParserImpl(), VerifyChecksumImpl(), IngressImpl(), EgressImpl(),\n"
+                 "         ComputeChecksumImpl(), DeparserImpl()) main;\n";
+          return out.str();
+        }
+
+      private:
+        // With probability dependencyDensity an operand reuses a field some
+        // earlier table wrote; otherwise it gets a field of its own.
+        unsigned pickField() {
+          std::bernoulli_distribution reuse(shape.dependencyDensity);
+          if (!written.empty() && reuse(rng))
+            return written[std::uniform_int_distribution<size_t>(0, written.size() - 1)(rng)];
+          return numFields++;
+        }
+
+        void emitTable(std::ostream &out, unsigned t) {
+          std::vector<unsigned> defs;
+          for (unsigned a = 0; a < shape.actionsPerTable; a++) {
+            //Half of the fields (rounded up) are written, each with the sum
+            //of all the others, so wide actions also give deep expressions
+            unsigned writes = (shape.fieldsPerAction + 1) / 2;
+            std::vector<unsigned> reads;
+            for (unsigned r = writes; r < shape.fieldsPerAction; r++)
+              reads.push_back(pickField());
+
+            out << "    action a_" << t << "_" << a << "() {\n";
+            for (unsigned w = 0; w < writes; w++) {
+              unsigned def = pickField();
+              defs.push_back(def);
+              out << "        meta.m" << def << " = ";
+              for (auto r : reads)
+                out << "meta.m" << r << " + ";
+              out << "1;\n";
+            }
+            out << "    }\n";
+          }
+
+          out << "    table t_" << t << " {\n        key = {\n";
+          out << "            meta.m" << pickField() << ": exact;\n        }\n";
+          out << "        actions = {\n";
+          for (unsigned a = 0; a < shape.actionsPerTable; a++)
+            out << "            a_" << t << "_" << a << ";\n";
+          out << "            NoAction;\n        }\n";
+          out << "        default_action = NoAction();\n    }\n";
+
+          written.insert(written.end(), defs.begin(), defs.end());
+        }
+
+        // Applies tables [lo, hi). Each nesting level splits the range into
+        // a flat prefix and two exclusive arms, alternating between if and
+        // switch statements.
+        void emitBlock(std::ostream &out, unsigned lo, unsigned hi, unsigned depth,
+            const std::string &indent) {
+          if (depth == 0 || hi - lo < 3 || shape.actionsPerTable == 0) {
+            for (unsigned t = lo; t < hi; t++)
+              out << indent << "t_" << t << ".apply();\n";
+            return;
+          }
+
+          unsigned first = lo + (hi - lo) / 3;
+          unsigned second = lo + 2 * (hi - lo) / 3;
+          emitBlock(out, lo, first, 0, indent);
+          std::string inner = indent + "    ";
+          if (depth % 2 == 1) {
+            out << indent << "if (meta.m" << pickField() << " == 0) {\n";
+            emitBlock(out, first, second, depth - 1, inner);
+            out << indent << "} else {\n";
+            emitBlock(out, second, hi, depth - 1, inner);
+            out << indent << "}\n";
+          } else {
+            out << indent << "switch (t_" << first << ".apply().action_run) {\n";
+            out << inner << "a_" << first << "_0: {\n";
+            emitBlock(out, first + 1, second, depth - 1, inner + "    ");
+            out << inner << "}\n" << inner << "default: {\n";
+            emitBlock(out, second, hi, depth - 1, inner + "    ");
+            out << inner << "}\n" << indent << "}\n";
+          }
+        }
+
+        const PipelineShape &shape;
+        std::mt19937 rng;
+        unsigned numFields = 0;
+        std::vector<unsigned> written;
+    };
+
+  } //namespace
+
+  std::string generatePipeline(const PipelineShape &shape) {
+    return Generator(shape).run();
+  }
+
+} //namespace multip4
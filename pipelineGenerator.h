@@ -0,0 +1,32 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_PIPELINE_GENERATOR_H
+#define MULTIP4_PIPELINE_GENERATOR_H
+
+#include <string>
+
+namespace multip4 {
+
+  // Shape of a synthetic v1model program. All tables are applied in the
+  // ingress control; tables are nested in if/switch statements up to
+  // nestingDepth levels.
+  struct PipelineShape {
+    unsigned tables = 16;
+    unsigned actionsPerTable = 2;
+    unsigned fieldsPerAction = 4;
+    unsigned nestingDepth = 0;
+    // Probability that a key or an action operand refers to a field written
+    // by an earlier table, i.e. creates a dependency.
+    double dependencyDensity = 0.3;
+    unsigned seed = 1;
+  };
+
+  // Returns the P4-16 source of a program with the given shape. The same
+  // shape always yields the same program.
+  std::string generatePipeline(const PipelineShape &shape);
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,226 @@
+/*
+Written by Seungbin Song
+*/
+
+#include "resultWriter.h"
+#include "instrumentation.h"
+#include "tableAnalyzer.h"
+
+namespace multip4 {
+
+  static const size_t BufferSize = 64 * 1024;
+
+  ResultWriter::ResultWriter(std::ostream &out, const Options &options)
+    : out(out), json(options.resultsFormat == "ndjson"), detail(Stats) {
+    if (options.resultsDetail == "tables")
+      detail = Tables;
+    else if (options.resultsDetail == "dependencies")
+      detail = Dependencies;
+    else if (options.resultsDetail == "pairs")
+      detail = Pairs;
+    buffer.reserve(BufferSize);
+  }
+
+  void ResultWriter::writeStat(const Stat &stat) {
+    beginRecord("stat", stat);
+    field("tables", (long)stat.numTable);
+    field("tableIndependentPairs", (long)stat.numTableIndependentPair);
+    field("actionIndependentPairs", (long)stat.numActionIndependentPair);
+    field("exclusivePairs", (long)stat.numExclusivePair);
+    endRecord();
+  }
+
+  void ResultWriter::writeDepth(const Stat &stat) {
+    beginRecord("depth", stat);
+    field("depth", (long)stat.depth);
+    field("tableDepth", (long)stat.tableDepth);
+    listField("levelWidths", stat.levelWidths);
+    listField("criticalTables", stat.criticalTables);
+    endRecord();
+  }
+
+  void ResultWriter::writeStages(const Stat &stat, const StagePlan &plan, const Graphs &graph) {
+    std::vector<cstring> names;
+    for (auto v : plan.criticalTables)
+      names.push_back(graph.vertexName(v));
+    beginRecord("stages", stat);
+    field("stages", (long)plan.numStages);
+    field("criticalStages", (long)plan.criticalStages);
+    field("oversized", (long)plan.oversized);
+    listField("criticalTables", names);
+    endRecord();
+  }
+
+  void ResultWriter::writePlacement(const Stat &stat, const Table *table, int stage) {
+    beginRecord("placement", stat);
+    field("table", table->name);
+    field("stage", (long)stage);
+    field("memory", (long)table->memory);
+    endRecord();
+  }
+
+  void ResultWriter::writeTable(const Stat &stat, const Table *table,
+      const FieldInterner &fields) {
+    std::vector<cstring> names;
+    beginRecord("table", stat);
+    field("name", table->name);
+    for (auto k : table->keys)
+      names.push_back(fields.name(k));
+    listField("keys", names);
+    endRecord();
+
+    for (auto a : table->actions) {
+      beginRecord("action", stat);
+      field("table", table->name);
+      field("name", a.first);
+      names.clear();
+      for (auto d : a.second->def)
+        names.push_back(fields.name(d));
+      listField("def", names);
+      names.clear();
+      for (auto u : a.second->use)
+        names.push_back(fields.name(u));
+      listField("use", names);
+      endRecord();
+    }
+  }
+
+  void ResultWriter::writeDependency(const Stat &stat, const Dependency &dependency) {
+    static const char *kinds[] = {"table", "action", "stateful"};
+    static const char *types[] = {"UseDef", "DefUse", "DefDef"};
+    beginRecord("dependency", stat);
+    field("from", dependency.firstTable->name);
+    field("to", dependency.secondTable->name);
+    field("kind", kinds[(int)dependency.kind]);
+    field("type", types[dependency.type]);
+    field("field", dependency.dataName);
+    endRecord();
+  }
+
+  void ResultWriter::writePair(const Stat &stat, const Table *first, const Table *second,
+      bool tableIndependent, bool actionIndependent, bool exclusive) {
+    beginRecord("pair", stat);
+    field("first", first->name);
+    field("second", second->name);
+    field("independence", exclusive ? "exclusive" : tableIndependent ? "table" :
+        actionIndependent ? "action" : "none");
+    endRecord();
+  }
+
+  void ResultWriter::append(std::istream &in) {
+    flush();
+    if (in.peek() != std::istream::traits_type::eof())
+      out << in.rdbuf();
+  }
+
+  void ResultWriter::flush() {
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+
+  void ResultWriter::beginRecord(const char *type, const Stat &stat) {
+    if (json) {
+      buffer += "{\"record\": \"";
+      buffer += type;
+      buffer += "\"";
+    } else {
+      buffer += type;
+    }
+    field("file", stat.fileName);
+    field("control", stat.pipelineName);
+  }
+
+  void ResultWriter::field(const char *name, cstring value) {
+    if (json) {
+      buffer += ", \"";
+      buffer += name;
+      buffer += "\": ";
+    } else {
+      buffer += ',';
+    }
+    writeText(value);
+  }
+
+  void ResultWriter::field(const char *name, long value) {
+    if (json) {
+      buffer += ", \"";
+      buffer += name;
+      buffer += "\": ";
+    } else {
+      buffer += ',';
+    }
+    buffer += std::to_string(value);
+  }
+
+  void ResultWriter::listField(const char *name, const std::vector<cstring> &values) {
+    if (!json) {
+      std::string joined;
+      for (auto &v : values) {
+        if (!joined.empty())
+          joined += ';';
+        joined += v.c_str();
+      }
+      field(name, cstring(joined));
+      return;
+    }
+    buffer += ", \"";
+    buffer += name;
+    buffer += "\": [";
+    for (size_t i = 0; i < values.size(); i++) {
+      if (i > 0)
+        buffer += ", ";
+      writeText(values[i]);
+    }
+    buffer += ']';
+  }
+
+  void ResultWriter::listField(const char *name, const std::vector<unsigned> &values) {
+    std::string joined;
+    for (size_t i = 0; i < values.size(); i++) {
+      if (i > 0)
+        joined += json ? ", " : ";";
+      joined += std::to_string(values[i]);
+    }
+    if (!json) {
+      field(name, cstring(joined));
+      return;
+    }
+    buffer += ", \"";
+    buffer += name;
+    buffer += "\": [";
+    buffer += joined;
+    buffer += ']';
+  }
+
+  void ResultWriter::endRecord() {
+    if (json)
+      buffer += '}';
+    buffer += '\n';
+    if (buffer.size() >= BufferSize)
+      flush();
+  }
+
+  // JSON strings are quoted and escaped; CSV values only when they contain a
+  // separator, a quote or a line break.
+  void ResultWriter::writeText(cstring value) {
+    if (json) {
+      appendJsonString(buffer, value);
+      return;
+    }
+    if (value == nullptr)
+      return;
+    std::string text = value.c_str();
+    if (text.find_first_of(",\"\n") == std::string::npos) {
+      buffer += text;
+      return;
+    }
+    buffer += '"';
+    for (char c : text) {
+      if (c == '"')
+        buffer += '"';
+      buffer += c;
+    }
+    buffer += '"';
+  }
+
+} //namespace multip4
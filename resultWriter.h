@@ -0,0 +1,87 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_RESULT_WRITER_H
+#define MULTIP4_RESULT_WRITER_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "lib/cstring.h"
+
+#include "exprSet.h"
+#include "multip4Options.h"
+
+namespace multip4 {
+
+  class Stat;
+  class Table;
+  class Dependency;
+  class Graphs;
+  struct StagePlan;
+
+  // Writes analysis records as CSV or NDJSON lines, one record per line.
+  // The first column (or the "record" key) names the record type:
+  //   stat:       file, control, tables, tableIndependentPairs, actionIndependentPairs,
+  //               exclusivePairs
+  //   depth:      file, control, depth, tableDepth, levelWidths, criticalTables
+  //   stages:     file, control, stages, criticalStages, oversized, criticalTables
+  //   table:      file, control, name, keys
+  //   placement:  file, control, table, stage, memory
+  //   action:     file, control, table, name, def, use
+  //   dependency: file, control, from, to, kind, type, field
+  //   pair:       file, control, first, second, independence
+  // List columns are joined with ';' in CSV and are arrays in NDJSON.
+  //
+  // Records are collected in a buffer that is handed to the stream in large
+  // blocks, so no record causes a flush of its own.
+  class ResultWriter {
+    public:
+      // Each level also writes the records of the levels before it.
+      enum Detail { Stats, Tables, Dependencies, Pairs };
+
+      ResultWriter(std::ostream &out, const Options &options);
+      ResultWriter(const ResultWriter &) = delete;
+      ResultWriter& operator=(const ResultWriter &) = delete;
+      ~ResultWriter() { flush(); }
+
+      bool wants(Detail level) const { return level <= detail; }
+
+      void writeStat(const Stat &stat);
+      void writeDepth(const Stat &stat);
+      // --pack-stages: the stage count at the stats level, and the stage of
+      // each table with its table record.
+      void writeStages(const Stat &stat, const StagePlan &plan, const Graphs &graph);
+      void writePlacement(const Stat &stat, const Table *table, int stage);
+      // A table record followed by one action record per action.
+      void writeTable(const Stat &stat, const Table *table, const FieldInterner &fields);
+      void writeDependency(const Stat &stat, const Dependency &dependency);
+      void writePair(const Stat &stat, const Table *first, const Table *second,
+          bool tableIndependent, bool actionIndependent, bool exclusive);
+
+      // Copies records already written by another ResultWriter with the same
+      // options, e.g. of a worker process.
+      void append(std::istream &in);
+      void flush();
+
+    private:
+      void beginRecord(const char *type, const Stat &stat);
+      void field(const char *name, cstring value);
+      void field(const char *name, long value);
+      void listField(const char *name, const std::vector<cstring> &values);
+      void listField(const char *name, const std::vector<unsigned> &values);
+      void endRecord();
+      void writeText(cstring value);
+
+      std::ostream &out;
+      bool json;
+      Detail detail;
+      std::string buffer;
+  };
+
+} //namespace multip4
+
+#endif
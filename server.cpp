@@ -0,0 +1,434 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lib/error.h"
+
+#include "driver.h"
+#include "server.h"
+
+namespace multip4 {
+
+  struct Request {
+    std::string id = "null";
+    std::string command;
+    std::string file;
+    std::vector<std::string> includes;
+    std::vector<std::string> defines;
+    std::string detail = "stats";
+    std::string incremental;
+  };
+
+  // Reads the flat JSON objects of requests: string, string-array and
+  // scalar members. Other values are checked for syntax and skipped.
+  class RequestParser {
+    public:
+      explicit RequestParser(const std::string &text) : text(text) {}
+
+      bool parse(Request &request, std::string &error) {
+        skipSpace();
+        if (!consume('{'))
+          return fail(error, "expected an object");
+        skipSpace();
+        if (consume('}'))
+          return end(error);
+        do {
+          std::string key;
+          skipSpace();
+          if (!string(key))
+            return fail(error, "expected a member name");
+          skipSpace();
+          if (!consume(':'))
+            return fail(error, "expected ':'");
+          skipSpace();
+          size_t start = pos;
+          std::string str;
+          std::vector<std::string> list;
+          bool isString = peek() == '"';
+          bool isList = peek() == '[';
+          if (!(isString ? string(str) : isList ? stringList(list) : skipValue()))
+            return fail(error, "bad value of \"" + key + "\"");
+          if (key == "id") {
+            //Echoed back as given, so only a string, number or null will do
+            if (isString) {
+              request.id.clear();
+              appendJsonString(request.id, str);
+            } else if (isNumber(text.substr(start, pos - start)) ||
+                text.compare(start, pos - start, "null") == 0) {
+              request.id = text.substr(start, pos - start);
+            } else {
+              return fail(error, "\"id\" must be a string, number or null");
+            }
+          } else if (key == "command" || key == "file" || key == "detail" ||
+              key == "incremental") {
+            if (!isString)
+              return fail(error, "\"" + key + "\" must be a string");
+            (key == "command" ? request.command : key == "file" ? request.file :
+             key == "detail" ? request.detail : request.incremental) = str;
+          } else if (key == "includes" || key == "defines") {
+            if (!isList)
+              return fail(error, "\"" + key + "\" must be an array of strings");
+            (key == "includes" ? request.includes : request.defines) = list;
+          }
+          skipSpace();
+        } while (consume(','));
+        if (!consume('}'))
+          return fail(error, "expected ',' or '}'");
+        return end(error);
+      }
+
+    private:
+      char peek() const { return pos < text.size() ? text[pos] : '\0'; }
+      bool consume(char c) {
+        if (peek() != c)
+          return false;
+        pos++;
+        return true;
+      }
+      void skipSpace() {
+        while (pos < text.size() && isspace((unsigned char)text[pos]))
+          pos++;
+      }
+      bool end(std::string &error) {
+        skipSpace();
+        return pos == text.size() || fail(error, "trailing characters");
+      }
+      bool fail(std::string &error, const std::string &message) {
+        error = message + " at offset " + std::to_string(pos);
+        return false;
+      }
+
+      bool string(std::string &out) {
+        if (!consume('"'))
+          return false;
+        while (pos < text.size() && text[pos] != '"') {
+          char c = text[pos++];
+          if (c != '\\') {
+            out += c;
+            continue;
+          }
+          if (pos >= text.size())
+            return false;
+          char e = text[pos++];
+          switch (e) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+              //Paths and macros are ASCII; anything else is kept escaped
+              if (pos + 4 > text.size())
+                return false;
+              unsigned code = 0;
+              for (size_t i = pos; i < pos + 4; i++) {
+                if (!isxdigit((unsigned char)text[i]))
+                  return false;
+                code = code * 16 + (isdigit((unsigned char)text[i]) ? text[i] - '0' :
+                    tolower((unsigned char)text[i]) - 'a' + 10);
+              }
+              if (code < 0x80)
+                out += (char)code;
+              else
+                out += "\\u" + text.substr(pos, 4);
+              pos += 4;
+              break;
+            }
+            default: out += e; break;
+          }
+        }
+        return consume('"');
+      }
+
+      bool stringList(std::vector<std::string> &out) {
+        if (!consume('['))
+          return false;
+        skipSpace();
+        if (consume(']'))
+          return true;
+        do {
+          skipSpace();
+          std::string s;
+          if (!string(s))
+            return false;
+          out.push_back(s);
+          skipSpace();
+        } while (consume(','));
+        return consume(']');
+      }
+
+      // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+      static bool isNumber(const std::string &s) {
+        size_t i = 0;
+        auto digits = [&]() {
+          size_t start = i;
+          while (i < s.size() && isdigit((unsigned char)s[i]))
+            i++;
+          return i > start;
+        };
+        if (i < s.size() && s[i] == '-')
+          i++;
+        if (i < s.size() && s[i] == '0')
+          i++;
+        else if (!digits())
+          return false;
+        if (i < s.size() && s[i] == '.') {
+          i++;
+          if (!digits())
+            return false;
+        }
+        if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+          i++;
+          if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+            i++;
+          if (!digits())
+            return false;
+        }
+        return i == s.size();
+      }
+
+      bool skipValue() {
+        char c = peek();
+        if (c == '"') {
+          std::string ignored;
+          return string(ignored);
+        }
+        if (c == '[' || c == '{') {
+          char close = c == '[' ? ']' : '}';
+          pos++;
+          skipSpace();
+          if (consume(close))
+            return true;
+          do {
+            skipSpace();
+            if (c == '{') {
+              std::string ignored;
+              if (!string(ignored))
+                return false;
+              skipSpace();
+              if (!consume(':'))
+                return false;
+              skipSpace();
+            }
+            if (!skipValue())
+              return false;
+            skipSpace();
+          } while (consume(','));
+          return consume(close);
+        }
+        size_t start = pos;
+        while (pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '-' ||
+              text[pos] == '+' || text[pos] == '.'))
+          pos++;
+        return pos > start;
+      }
+
+      const std::string &text;
+      size_t pos = 0;
+  };
+
+  // p4c hands the file and preprocessor_options to the shell, so the file,
+  // include paths and defines are limited to characters that the shell
+  // takes literally.
+  static bool shellSafe(const std::string &arg) {
+    if (arg.empty())
+      return false;
+    for (char c : arg) {
+      if (!isalnum((unsigned char)c) && strchr("/._-+,:=@%", c) == nullptr)
+        return false;
+    }
+    return true;
+  }
+
+  static std::string badArgument(const Request &request) {
+    if (!shellSafe(request.file))
+      return "bad file \"" + request.file + "\"";
+    if (!request.incremental.empty() && !shellSafe(request.incremental))
+      return "bad incremental directory \"" + request.incremental + "\"";
+    for (auto &dir : request.includes) {
+      if (!shellSafe(dir))
+        return "bad include path \"" + dir + "\"";
+    }
+    for (auto &define : request.defines) {
+      if (!shellSafe(define))
+        return "bad define \"" + define + "\"";
+    }
+    return "";
+  }
+
+  static std::string handleRequest(const Request &request) {
+    std::ostringstream out, records, metricsJson;
+    bool ok;
+    unsigned errors;
+    {
+      //The request's settings go into a context copied from the server's;
+      //analyzeInNewContext copies it again for the file itself
+      AutoCompileContext requestContext(new Multip4Context(Multip4Context::get()));
+      auto &options = Multip4Context::get().options();
+      for (auto &dir : request.includes)
+        options.preprocessor_options += " -I" + dir;
+      for (auto &define : request.defines)
+        options.preprocessor_options += " -D" + define;
+      if (!request.incremental.empty()) {
+        options.incrementalDir = request.incremental;
+        options.noCache = true;
+      }
+      options.resultsFile = "(response)";
+      options.resultsFormat = "ndjson";
+      options.resultsDetail = request.detail;
+
+      Metrics metrics(request.file);
+      {
+        ResultWriter results(records, options);
+        ok = analyzeInNewContext(request.file, out, &metrics, &results);
+      }
+      errors = metrics.get("errors");
+      metrics.writeJson(metricsJson);
+    }
+
+    std::string response = "{\"id\":" + request.id + ",\"ok\":" + (ok ? "true" : "false") +
+      ",\"errors\":" + std::to_string(errors) + ",\"output\":";
+    appendJsonString(response, out.str());
+    response += ",\"records\":[";
+    std::istringstream lines(records.str());
+    std::string line;
+    bool first = true;
+    while (std::getline(lines, line)) {
+      if (line.empty())
+        continue;
+      if (!first)
+        response += ",";
+      response += line;
+      first = false;
+    }
+    response += "],\"metrics\":" + metricsJson.str() + "}\n";
+    return response;
+  }
+
+  static std::string errorResponse(const std::string &id, const std::string &message) {
+    std::string response = "{\"id\":" + id + ",\"ok\":false,\"error\":";
+    appendJsonString(response, message);
+    return response + "}\n";
+  }
+
+  static bool writeAll(int fd, const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t n = write(fd, data.data() + done, data.size() - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      done += n;
+    }
+    return true;
+  }
+
+  // Answers the requests of one connection until it is closed. Returns
+  // false when a shutdown was requested.
+  static bool serveConnection(int in, int out) {
+    std::string buffer;
+    char chunk[64 * 1024];
+    for (;;) {
+      size_t newline;
+      while ((newline = buffer.find('\n')) == std::string::npos) {
+        ssize_t n = read(in, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return true;
+        buffer.append(chunk, n);
+      }
+      std::string line = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+
+      Request request;
+      std::string error, badArg;
+      std::string response;
+      bool shutdown = false;
+      if (!RequestParser(line).parse(request, error)) {
+        response = errorResponse(request.id, error);
+      } else if (request.command == "shutdown") {
+        response = "{\"id\":" + request.id + ",\"ok\":true}\n";
+        shutdown = true;
+      } else if (!request.command.empty()) {
+        response = errorResponse(request.id, "unknown command " + request.command);
+      } else if (request.file.empty()) {
+        response = errorResponse(request.id, "missing \"file\"");
+      } else if (request.detail != "stats" && request.detail != "tables" &&
+          request.detail != "dependencies" && request.detail != "pairs") {
+        response = errorResponse(request.id, "bad \"detail\" " + request.detail);
+      } else if (!(badArg = badArgument(request)).empty()) {
+        response = errorResponse(request.id, badArg);
+      } else {
+        response = handleRequest(request);
+      }
+      if (!writeAll(out, response))
+        return true;
+      if (shutdown)
+        return false;
+    }
+  }
+
+  int serve(cstring address) {
+    //A client that goes away must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    if (address == "-") {
+      serveConnection(STDIN_FILENO, STDOUT_FILENO);
+      return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) {
+      ::error("%1%: socket path too long", address);
+      return 1;
+    }
+    strcpy(addr.sun_path, address.c_str());
+
+    //Replace a socket left behind by an earlier server, but nothing else
+    struct stat st;
+    if (lstat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(address);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+      ::error("%1%: cannot listen: %2%", address, strerror(errno));
+      if (fd >= 0)
+        close(fd);
+      return 1;
+    }
+
+    bool running = true;
+    while (running) {
+      int client = accept(fd, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR)
+          continue;
+        ::error("%1%: accept failed: %2%", address, strerror(errno));
+        break;
+      }
+      running = serveConnection(client, client);
+      close(client);
+    }
+    close(fd);
+    unlink(address);
+    return running ? 1 : 0;
+  }
+
+} //namespace multip4
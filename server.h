@@ -0,0 +1,29 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_SERVER_H
+#define MULTIP4_SERVER_H
+
+#include "lib/cstring.h"
+
+namespace multip4 {
+
+  // Serves analysis requests from one process, so the startup work of the
+  // compiler (GC, option parsing, frontend setup) and the analysis cache
+  // are shared by all of them. address is a UNIX socket path, or - for
+  // stdin / stdout. Connections are served one at a time; every request and
+  // response is one line of JSON:
+  //
+  //   {"id": 1, "file": "a.p4", "includes": ["dir"], "defines": ["X=1"],
+  //    "detail": "stats|tables|dependencies|pairs", "incremental": "dir"}
+  //   {"id": 1, "ok": true, "errors": 0, "output": "<stat lines>",
+  //    "records": [<--results records>], "metrics": {<--stats-json object>}}
+  //
+  // Only "file" is required; "id" is echoed back as given. The request
+  // {"command": "shutdown"} stops the server. Returns the exit status.
+  int serve(cstring address);
+
+} //namespace multip4
+
+#endif
@@ -0,0 +1,133 @@
+/*
+Written by Seungbin Song
+*/
+
+#include <algorithm>
+#include <queue>
+
+#include "lib/error.h"
+
+#include "stagePacker.h"
+
+namespace multip4 {
+
+  namespace {
+
+    struct Successor {
+      Graphs::vertex_t to;
+      unsigned gap;
+    };
+
+    struct StageUse {
+      unsigned tables = 0;
+      uint64_t memory = 0;
+    };
+
+  } //namespace
+
+  StagePlan packStages(Graphs &graph, const std::vector<uint64_t> &memory,
+      const StageBudget &budget) {
+    StagePlan plan;
+    size_t n = graph.numVertices();
+    plan.stage.assign(n, -1);
+
+    //One entry per parallel edge; the largest gap of a pair wins anyway. A
+    //condition takes no stage, so what depends on it only waits for the
+    //tables before it.
+    std::vector<std::vector<Successor>> successors(n);
+    std::vector<unsigned> inDegree(n, 0);
+    const auto &all = graph.edgeView(Graphs::EdgeFilter::ALL);
+    const auto &table = graph.edgeView(Graphs::EdgeFilter::TABLE);
+    for (Graphs::vertex_t v = 0; v < n; v++) {
+      bool condition = graph.isCondition(v);
+      for (auto i = all.offsets[v]; i < all.offsets[v + 1]; i++) {
+        successors[v].push_back({all.targets[i], condition ? 0 : budget.actionGap});
+        inDegree[all.targets[i]]++;
+      }
+      for (auto i = table.offsets[v]; i < table.offsets[v + 1]; i++) {
+        successors[v].push_back({table.targets[i], condition ? 0 : budget.matchGap});
+        inDegree[table.targets[i]]++;
+      }
+    }
+
+    std::vector<Graphs::vertex_t> order;
+    if (!graph.topologicalOrder(order)) {
+      ::warning("Dependence graph has a cycle; tables are not packed into stages");
+      return plan;
+    }
+
+    //head: earliest stage with unlimited budgets, and the predecessor that
+    //sets it. tail: stages the chain of dependents after a vertex needs.
+    auto gap = [&graph, &budget](Graphs::vertex_t v, Graphs::EdgeType type) -> unsigned {
+      if (graph.isCondition(v))
+        return 0;
+      return type == Graphs::EdgeType::TABLE ? std::max(budget.matchGap, budget.actionGap)
+        : budget.actionGap;
+    };
+    std::vector<unsigned> head, tail(n, 0);
+    std::vector<int> critical;
+    graph.longestPaths(order, gap, head, critical);
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      for (auto &s : successors[*it])
+        tail[*it] = std::max(tail[*it], s.gap + tail[s.to]);
+    }
+
+    int last = -1;
+    for (Graphs::vertex_t v = 0; v < n; v++) {
+      if (!graph.isCondition(v) && (last < 0 || head[v] > head[last]))
+        last = v;
+    }
+    if (last < 0)
+      return plan;
+    plan.criticalStages = head[last] + 1;
+    for (int v = last; v >= 0; v = critical[v]) {
+      if (!graph.isCondition(v))
+        plan.criticalTables.push_back(v);
+    }
+    std::reverse(plan.criticalTables.begin(), plan.criticalTables.end());
+
+    //Longest tail first; ties go to the vertex created first
+    auto later = [&tail](Graphs::vertex_t a, Graphs::vertex_t b) {
+      return tail[a] != tail[b] ? tail[a] < tail[b] : a > b;
+    };
+    std::priority_queue<Graphs::vertex_t, std::vector<Graphs::vertex_t>, decltype(later)>
+      ready(later);
+    std::vector<unsigned> earliest(n, 0);
+    std::vector<unsigned> remaining(inDegree);
+    for (Graphs::vertex_t v = 0; v < n; v++) {
+      if (remaining[v] == 0)
+        ready.push(v);
+    }
+
+    std::vector<StageUse> stages;
+    while (!ready.empty()) {
+      auto v = ready.top();
+      ready.pop();
+      unsigned s = earliest[v];
+      if (!graph.isCondition(v)) {
+        bool oversized = budget.memory != 0 && memory[v] > budget.memory;
+        for (;; s++) {
+          if (s >= stages.size())
+            stages.resize(s + 1);
+          auto &use = stages[s];
+          if (oversized ? use.tables == 0 :
+              (budget.tables == 0 || use.tables < budget.tables) &&
+              (budget.memory == 0 || use.memory + memory[v] <= budget.memory))
+            break;
+        }
+        stages[s].tables++;
+        stages[s].memory += memory[v];
+        plan.stage[v] = s;
+        plan.oversized += oversized;
+        plan.numStages = std::max<unsigned>(plan.numStages, s + 1);
+      }
+      for (auto &succ : successors[v]) {
+        earliest[succ.to] = std::max(earliest[succ.to], s + succ.gap);
+        if (--remaining[succ.to] == 0)
+          ready.push(succ.to);
+      }
+    }
+    return plan;
+  }
+
+} //namespace multip4
@@ -0,0 +1,49 @@
+/*
+Written by Seungbin Song
+*/
+
+#ifndef MULTIP4_STAGE_PACKER_H
+#define MULTIP4_STAGE_PACKER_H
+
+#include <vector>
+
+#include "graphs.h"
+
+namespace multip4 {
+
+  // How far apart dependent tables must be placed, and what one stage holds.
+  struct StageBudget {
+    // Stages between a table and one with a match (TABLE) dependency on it,
+    // and with only an action or stateful dependency on it. Independent
+    // tables may share a stage.
+    unsigned matchGap = 2;
+    unsigned actionGap = 1;
+    // Tables and bytes of match memory per stage; 0 for no limit.
+    unsigned tables = 0;
+    uint64_t memory = 0;
+  };
+
+  struct StagePlan {
+    // Stage of every vertex, or -1 for conditions, which take no stage.
+    std::vector<int> stage;
+    unsigned numStages = 0;
+    // Stages the longest dependency chain needs, whatever the budgets: no
+    // placement can use fewer.
+    unsigned criticalStages = 0;
+    // The tables of that chain, in pipeline order.
+    std::vector<Graphs::vertex_t> criticalTables;
+    // Tables whose memory exceeds a whole stage; each got a stage alone.
+    unsigned oversized = 0;
+  };
+
+  // Assigns the tables of a dependence graph to pipeline stages by list
+  // scheduling: tables are placed once everything they depend on is, those
+  // with the longest chain of dependents first, each in the earliest stage
+  // that its dependencies and the budgets allow. memory holds the match
+  // memory of every vertex in bytes. A graph with a cycle is not packed.
+  StagePlan packStages(Graphs &graph, const std::vector<uint64_t> &memory,
+      const StageBudget &budget);
+
+} //namespace multip4
+
+#endif
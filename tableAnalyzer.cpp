@@ -3,8 +3,16 @@ Written by Seungbin Song
 */
 
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+
 #include "tableAnalyzer.h"
+#include "analysisFile.h"
 #include "graphs.h"
+#include "parallel.h"
 
 #include "frontends/p4/methodInstance.h"
 #include "frontends/p4/tableApply.h"
@@ -14,66 +22,67 @@ Written by Seungbin Song
 
 namespace multip4 {
 
-  static ExprSet unionExprSet (const ExprSet& e1, const ExprSet& e2) {
-    ExprSet result = e1;
-    for (auto i2 : e2) {
-      result.insert(i2);
-    }
-    return result;
-  }
-
-  static ExprSet subtractExprSet (const ExprSet& e1, const ExprSet& e2) {
-    ExprSet result = e1;
-    for (auto i2 : e2) {
-      result.erase(i2);
-    }
-    return result;
-  }
+  // Entries assumed for a table without a size property.
+  static const uint64_t DefaultTableSize = 1024;
 
-  void Action::print() {
-     std::cout << "    Def: " << std::endl;
+  void Action::print(const FieldInterner &fields) {
+     std::cout << "    Def: \n";
     for(auto e : this->def)
-      std::cout << "      " << e << std::endl;
-    std::cout << "    Use: " << std::endl;
+      std::cout << "      " << fields.name(e) << "\n";
+    std::cout << "    Use: \n";
     for(auto e : this->use)
-      std::cout << "      " << e << std::endl;
+      std::cout << "      " << fields.name(e) << "\n";
  }
 
-  void Table::print () {
-    std::cout << "Name: " << this->name << std::endl;
+  void Table::print (const FieldInterner &fields) {
+    std::cout << "Name: " << this->name << "\n";
     for (auto k : this->keys)
-      std::cout << "    Key: " << k << std::endl;
+      std::cout << "    Key: " << fields.name(k) << "\n";
     for (auto a : this->actions) {
-      std::cout << "    Action: " << a.first << std::endl;
-      a.second->print();
+      std::cout << "    Action: " << a.first << "\n";
+      a.second->print(fields);
     }
   }
 
-  void Stat::print () {
-    std::cout << fileName << ", " << pipelineName << ", " << numTable << ", "
-      << numTableIndependentPair << ", " << numActionIndependentPair << std::endl;
+  bool Table::exclusiveWith(const Table *other) const {
+    size_t n = std::min(branches.size(), other->branches.size());
+    for (size_t i = 0; i < n; i++) {
+      if (branches[i].first != other->branches[i].first)
+        return false;
+      if (branches[i].second != other->branches[i].second)
+        return true;
+    }
+    return false;
+  }
+
+  void Stat::print (std::ostream &out) {
+    out << fileName << ", " << pipelineName << ", " << numTable << ", "
+      << numTableIndependentPair << ", " << numActionIndependentPair << "\n";
   }
 
   Stat::Stat(cstring name, cstring fname) : numTable(0), 
-    numTableIndependentPair(0), numActionIndependentPair(0),
+    numTableIndependentPair(0), numActionIndependentPair(0), numExclusivePair(0),
+    depth(0), tableDepth(0),
     pipelineName(name), fileName(fname) {}
 
-  Action::Action() : action(nullptr), def({}), use({}) {}
+  Action::Action() : action(nullptr) {}
 
   Dependency::Dependency(Table* _first, Table* _second, DependencyType _type, 
-      bool _isTableDependency, cstring _dataName) {
+      Graphs::EdgeType _kind, cstring _dataName) {
     firstTable = _first;
     secondTable = _second;
     type = _type;
-    isTableDependency = _isTableDependency;
+    kind = _kind;
     dataName = _dataName;
   }
 
   void Dependency::print() {
     std::cout << "Table1: " << firstTable->name << ", ";
     std::cout << "Table2: " << secondTable->name << " ";
-    if(isTableDependency)
+    if(kind == Graphs::EdgeType::TABLE)
       std::cout << "[Table ";
+    else if(kind == Graphs::EdgeType::STATEFUL)
+      std::cout << "[Stateful ";
     else 
       std::cout << "[Action ";
     if(type == DependencyType::UseDef)
@@ -82,176 +91,950 @@ namespace multip4 {
       std::cout << "Def-Use] ";
     else 
       std::cout << "Def-Def] ";
-    std::cout << "id: " << dataName << std::endl;
+    std::cout << "id: " << dataName << "\n";
   }
 
-  TableAnalyzer::TableAnalyzer(P4::ReferenceMap *refMap, P4::TypeMap *typeMap, cstring file)
-    : refMap(refMap), typeMap(typeMap), fileName(file), curAction(new Action()), 
-      curActionMap(new ActionMap()), curTable(new Table()), 
-      tableStack(new TableStack()), dependencies(new Dependencies()), graph(new Graphs()){}
+  TableAnalyzer::TableAnalyzer(P4::ReferenceMap *refMap, P4::TypeMap *typeMap,
+      const Options &options, std::ostream &out, Metrics *metrics, ResultWriter *results,
+      IncrementalResult *incremental)
+    : refMap(refMap), typeMap(typeMap), options(options), out(out), metrics(metrics),
+      results(results), incremental(incremental),
+      curAction(nullptr), 
+      curTable(nullptr), control(nullptr) {
+    //Tables and sub-controls applied more than once are analyzed at every
+    //apply site, unless --first-apply-only asks for the old behavior
+    visitDagOnce = options.firstApplyOnly;
+  }
+
+  ControlContext::ControlContext(cstring name, const Options &options, Metrics *metrics)
+    : graph(options.useBfs, options.dedupEdges), stat(name, options.file),
+      pairThreads(options.pairThreads),
+      keepPairMatrix(options.pairMatrixDir != nullptr ||
+          (options.resultsFile != nullptr && options.resultsDetail == "pairs")),
+      metrics(metrics), packStages(options.packStages) {
+    stageBudget.matchGap = options.matchGap;
+    stageBudget.actionGap = options.actionGap;
+    stageBudget.tables = options.stageTables;
+    stageBudget.memory = options.stageMemory;
+  }
 
   void TableAnalyzer::setCurrentAction(const IR::P4Action *action) {
     curAction->action = action;
-    curAction->def = {};
-    curAction->use = {};
+    curAction->def = ExprSet();
+    curAction->use = ExprSet();
   }
 
   void TableAnalyzer::saveCurrentAction() {
-    (*curActionMap)[curAction->action->toString()] = curAction;
-    curAction = new Action();
+    control->actionMap[curAction->action->toString()] = curAction;
+    curAction = control->arena.make<Action>();
   }
 
-  void TableAnalyzer::clearCurrentActionMap() {
-    delete(curActionMap);
-    curActionMap = new ActionMap();
+  ExprSet TableAnalyzer::findId(const IR::Expression *expr) {
+    ExprSet result;
+    collectIds(expr, result);
+    return result;
   }
 
-  ExprSet TableAnalyzer::findId(const IR::Expression *expr) {
-    if (expr->is<IR::ListExpression>()) {
-      auto exprList = expr->to<IR::ListExpression>()->components;
-      if (exprList.empty()) {
-        return {};
+  // Pushes the index expressions of the stack elements that field goes
+  // through: reading hdr.s[i].f reads i.
+  static void indexExpressions(const IR::Expression *field,
+      std::vector<const IR::Expression*> &out) {
+    for (auto e = field; e != nullptr;) {
+      if (auto m = e->to<IR::Member>()) {
+        e = m->expr;
+      } else if (auto slice = e->to<IR::Slice>()) {
+        e = slice->e0;
+      } else if (auto index = e->to<IR::ArrayIndex>()) {
+        if (!index->right->is<IR::Constant>())
+          out.push_back(index->right);
+        e = index->left;
       } else {
-        auto lastExpr = exprList.back();
-        exprList.pop_back();
-        const IR::Expression *rest = new IR::ListExpression(exprList);
-        return unionExprSet(findId(lastExpr), findId(rest));
-      }
-    }
-    if (expr->is<IR::Operation_Binary>()) {
-      const IR::Operation_Binary *bexpr = expr->to<IR::Operation_Binary>();
-      ExprSet lresult = findId(bexpr->left);
-      ExprSet rresult = findId(bexpr->right);
-      return unionExprSet(lresult, rresult);
-    }
-    if (expr->is<IR::Operation_Ternary>()) {
-      const IR::Operation_Ternary *texpr = expr->to<IR::Operation_Ternary>();
-      ExprSet e0r = findId(texpr->e0);
-      ExprSet e1r = findId(texpr->e1);
-      ExprSet e2r = findId(texpr->e2);
-      return unionExprSet(unionExprSet(e0r, e1r), e2r);
-    }
-    if (expr->is<IR::Operation_Unary>()) {
-      if (expr->is<IR::Member>()) {
-        auto m = expr->to<IR::Member>();
-        if (m->expr->is<IR::TypeNameExpression>()) {
-          return {};
+        break;
+      }
+    }
+  }
+
+  bool TableAnalyzer::appendFieldName(const IR::Expression *expr, std::string &name) {
+    if (auto slice = expr->to<IR::Slice>()) {
+      //A slice of a slice is a range of the field underneath
+      unsigned lo = slice->getL(), hi = slice->getH();
+      while (auto inner = slice->e0->to<IR::Slice>()) {
+        lo += inner->getL();
+        hi += inner->getL();
+        slice = inner;
+      }
+      if (!appendFieldName(slice->e0, name))
+        return false;
+      name += "[" + std::to_string(hi) + ":" + std::to_string(lo) + "]";
+    } else if (auto m = expr->to<IR::Member>()) {
+      if (m->expr->is<IR::TypeNameExpression>())
+        return false;
+      if (!appendFieldName(m->expr, name))
+        name += m->expr->toString().c_str();
+      //next and last are an element of the stack that is not known here
+      cstring member = m->member;
+      auto type = member == "next" || member == "last" ? typeMap->getType(m->expr) : nullptr;
+      if (type != nullptr && type->is<IR::Type_Stack>())
+        name += "[" + std::string(member.c_str()) + "]";
+      else
+        name += "." + std::string(member.c_str());
+    } else if (auto index = expr->to<IR::ArrayIndex>()) {
+      if (!appendFieldName(index->left, name))
+        name += index->left->toString().c_str();
+      auto constant = index->right->to<IR::Constant>();
+      name += "[" + (constant != nullptr ? std::to_string(constant->asUnsigned()) :
+          std::string(index->right->toString().c_str())) + "]";
+    } else if (expr->is<IR::AttribLocal>()) {
+      name += expr->toString().c_str();
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  int TableAnalyzer::fieldId(const IR::Expression *expr) {
+    std::string name;
+    if (!appendFieldName(expr, name))
+      return -1;
+    return fields.intern(name);
+  }
+
+  void TableAnalyzer::collectIds(const IR::Expression *expr, ExprSet &ids) {
+    if (control != nullptr)
+      control->findIdCalls++;
+    //Walk the expression with an explicit stack instead of recursion; the
+    //stack is a member so its storage is reused across calls
+    idStack.clear();
+    idStack.push_back(expr);
+    while (!idStack.empty()) {
+      auto e = idStack.back();
+      idStack.pop_back();
+      if (e == nullptr)
+        continue;
+
+      if (auto list = e->to<IR::ListExpression>()) {
+        for (auto c : list->components)
+          idStack.push_back(c);
+      } else if (auto init = e->to<IR::StructInitializerExpression>()) {
+        for (auto c : init->components)
+          idStack.push_back(c->expression);
+      } else if (auto call = e->to<IR::MethodCallExpression>()) {
+        for (auto a : *call->arguments)
+          idStack.push_back(a);
+      } else if (e->is<IR::ArrayIndex>() || e->is<IR::Slice>()) {
+        int id = fieldId(e);
+        if (id >= 0) {
+          ids.insert(id);
+          indexExpressions(e, idStack);
+        } else if (auto slice = e->to<IR::Slice>()) {
+          idStack.push_back(slice->e0);
         } else {
-          ExprSet result = {expr->toString()};
-          return result;
+          idStack.push_back(e->to<IR::ArrayIndex>()->right);
         }
-      } else {
-      return findId(expr->to<IR::Operation_Unary>()->expr);
+      } else if (auto bexpr = e->to<IR::Operation_Binary>()) {
+        idStack.push_back(bexpr->right);
+        idStack.push_back(bexpr->left);
+      } else if (auto texpr = e->to<IR::Operation_Ternary>()) {
+        idStack.push_back(texpr->e2);
+        idStack.push_back(texpr->e1);
+        idStack.push_back(texpr->e0);
+      } else if (e->is<IR::Member>()) {
+        int id = fieldId(e);
+        if (id >= 0) {
+          ids.insert(id);
+          indexExpressions(e, idStack);
+        }
+      } else if (auto uexpr = e->to<IR::Operation_Unary>()) {
+        idStack.push_back(uexpr->expr);
+      } else if (e->is<IR::AttribLocal>()) {
+        ids.insert(fields.intern(e->toString()));
       }
     }
-    if (expr->is<IR::AttribLocal>()) {
-      ExprSet result = {expr->toString()};
-      return result;
-    }
-    ExprSet v = {};
-    return v;
+  }
+
+  void TableAnalyzer::addDependency(const FieldAccess &from, DependencyType type,
+      Graphs::EdgeType kind, int field) {
+    control->dependencies.push_back(Dependency(from.table, curTable, type, kind,
+          fields.name(field)));
+    control->graph.add_edge(from.table->vertex, curTable->vertex, field, kind, type);
   }
 
   void TableAnalyzer::buildDependenceGraph() {
-    if (std::find(tableStack->begin(), tableStack->end(), curTable) != tableStack->end()) {
+    if (curTable->indexed) {
       ::error("[ERROR] curTable already exists in the tableStack");
       return;
     }
+    ScopedTimer timer(control->metrics, "buildDependenceGraph");
 
-    //find table dependency
-    for (auto t = tableStack->rbegin(); t != tableStack->rend(); ++t) {
-      for (auto a : (*t)->actions) {
-        for (auto k : curTable->keys) {
-          if (a.second->def.find(k) != a.second->def.end()) {
-            dependencies->push_back(Dependency(*t, curTable, DependencyType::DefUse, true, k));
-            graph->add_edge((*t)->vertex, curTable->vertex, k, Graphs::EdgeType::TABLE);
-          }
+    //Only the tables that access one of curTable's fields are looked at,
+    //through the field index of the tables already on the stack
+    auto accesses = [](const FieldIndex &index, int field) -> const std::vector<FieldAccess>& {
+      static const std::vector<FieldAccess> none;
+      return (size_t)field < index.size() ? index[field] : none;
+    };
+
+    //A field depends on the accesses to itself and to every field that
+    //shares bits with it: its slices, its header, other stack elements
+    //that may be the same one
+    auto depend = [&](const FieldIndex &index, int field, DependencyType type,
+        Graphs::EdgeType kind) {
+      for (auto &first : accesses(index, field)) {
+        if (first.table->onStack)
+          addDependency(first, type, kind, field);
+      }
+      for (auto other : fields.overlapping(field)) {
+        for (auto &first : accesses(index, other)) {
+          if (first.table->onStack)
+            addDependency(first, type, kind, field);
         }
       }
+    };
+
+    //find table dependency
+    for (auto k : curTable->keys)
+      depend(control->defIndex, k, DependencyType::DefUse, Graphs::EdgeType::TABLE);
+
+    //find action dependency; on the state of an extern instance it is a
+    //stateful one. Two reads of the same state do not conflict.
+    for (auto secondAction : curTable->actions) {
+      const Action *second = secondAction.second;
+      for (auto d : second->def) {
+        auto kind = statefulFields.contains(d) ? Graphs::EdgeType::STATEFUL
+          : Graphs::EdgeType::ACTION;
+        depend(control->defIndex, d, DependencyType::DefDef, kind);
+        depend(control->useIndex, d, DependencyType::UseDef, kind);
+      }
+      for (auto u : second->use) {
+        depend(control->defIndex, u, DependencyType::DefUse,
+            statefulFields.contains(u) ? Graphs::EdgeType::STATEFUL : Graphs::EdgeType::ACTION);
+      }
+    }
+
+  }
+
+  static void indexField(FieldIndex &index, int field, Table *table, const Action *action) {
+    if ((size_t)field >= index.size())
+      index.resize(field + 1);
+    index[field].push_back({table, action});
+  }
+
+  void ControlContext::pushTable(Table *table) {
+    table->onStack = true;
+    tableStack.push_back(table);
+    if (table->indexed)
+      return;
+    table->indexed = true;
+    for (auto a : table->actions) {
+      for (auto d : a.second->def)
+        indexField(defIndex, d, table, a.second);
+      for (auto u : a.second->use)
+        indexField(useIndex, u, table, a.second);
+    }
+  }
+
+  void ControlContext::popTables(size_t size) {
+    for (size_t i = size; i < tableStack.size(); i++)
+      tableStack[i]->onStack = false;
+    tableStack.resize(size);
+  }
+
+  // A red-black tree node holds its value, three links and a color; a hash
+  // node its value, a link and the cached hash.
+  template <typename Map>
+  static size_t treeNodeBytes(const Map &map) {
+    return map.size() * (sizeof(typename Map::value_type) + 4 * sizeof(void*));
+  }
+
+  template <typename Map>
+  static size_t hashNodeBytes(const Map &map) {
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) +
+      map.bucket_count() * sizeof(void*);
+  }
+
+  size_t ControlContext::analysisBytes() const {
+    size_t bytes = arena.bytesReserved() + tableStack.capacity() * sizeof(Table*) +
+      dependencies.capacity() * sizeof(Dependency) + graph.bytes();
+    for (auto &index : {&defIndex, &useIndex}) {
+      bytes += index->capacity() * sizeof(std::vector<FieldAccess>);
+      for (auto &accesses : *index)
+        bytes += accesses.capacity() * sizeof(FieldAccess);
+    }
+    //Every table ends up on the tableStack, and every action in actionMap
+    for (auto t : tableStack) {
+      bytes += treeNodeBytes(t->actions) + t->keys.heapBytes() +
+        t->branches.capacity() * sizeof(BranchPath::value_type);
+    }
+    bytes += treeNodeBytes(actionMap);
+    for (auto &a : actionMap) {
+      if (a.second != nullptr)
+        bytes += a.second->def.heapBytes() + a.second->use.heapBytes();
+    }
+    bytes += pairTables.capacity() * sizeof(Table*) + pairMatrix.capacity();
+    bytes += hashNodeBytes(controlSummaries);
+    for (auto &summary : controlSummaries)
+      bytes += summary.second.steps.capacity() * sizeof(ControlSummary::Step);
+    return bytes;
+  }
+
+  void ControlContext::recordMetrics() const {
+    if (metrics == nullptr)
+      return;
+    metrics->set("tables", stat.numTable);
+    metrics->set("exclusivePairs", stat.numExclusivePair);
+    metrics->set("depth", stat.depth);
+    metrics->set("tableDepth", stat.tableDepth);
+    metrics->set("vertices", graph.numVertices());
+    metrics->set("edges", graph.numEdges());
+    metrics->set("dependencies", dependencies.size());
+    metrics->set("findIdCalls", findIdCalls);
+    metrics->set("summaryHits", summaryHits);
+    metrics->set("bfsSearches", graph.bfsSearches());
+    metrics->set("reachRowsComputed", graph.reachabilityRowsComputed());
+    metrics->set("reachRowsReused", rowsReused);
+    metrics->set("restored", restored);
+    if (packStages) {
+      metrics->set("stages", stagePlan.numStages);
+      metrics->set("criticalStages", stagePlan.criticalStages);
+    }
+    metrics->set("peakAnalysisBytes", analysisBytes());
+  }
+
+  // Splits the rows of the upper triangle of an n x n pair matrix into at
+  // most `chunks` ranges holding about the same number of pairs. Returns the
+  // first row of every range, followed by n.
+  static std::vector<size_t> splitPairRows(size_t n, size_t chunks) {
+    std::vector<size_t> bounds = {0};
+    size_t pairs = n * (n - 1) / 2;
+    size_t target = (pairs + chunks - 1) / chunks;
+    size_t acc = 0;
+    for (size_t i = 0; i + 1 < n; i++) {
+      acc += n - 1 - i;
+      if (acc >= target) {
+        bounds.push_back(i + 1);
+        acc = 0;
+      }
     }
+    if (bounds.back() != n)
+      bounds.push_back(n);
+    return bounds;
+  }
+
+  void ControlContext::findIndependentTables() {
+    ScopedTimer timer(metrics, "findIndependentTables");
+    pairTables.clear();
+    for (auto t : tableStack) {
+      if (!graph.isCondition(t->vertex))
+        pairTables.push_back(t);
+    }
+    size_t n = pairTables.size();
+    stat.numTable += n;
+    findPipelineDepth();
+    if (n < 2)
+      return;
 
-    //find action dependency
-    for (auto t = tableStack->rbegin(); t != tableStack->rend(); ++t) {
-      for (auto firstAction : (*t)->actions) {
-        for (auto secondAction : curTable->actions) {
-          for (auto d : secondAction.second->def) {
-            if (firstAction.second->def.find(d) != firstAction.second->def.end()) {
-              dependencies->push_back(Dependency(*t, curTable, DependencyType::DefDef, false, d));
-              graph->add_edge((*t)->vertex, curTable->vertex, d, Graphs::EdgeType::ACTION);
-            }
-            if (firstAction.second->use.find(d) != firstAction.second->use.end()) {
-              dependencies->push_back(Dependency(*t, curTable, DependencyType::UseDef, false, d));
-              graph->add_edge((*t)->vertex, curTable->vertex, d, Graphs::EdgeType::ACTION);
-            }
+    graph.prepareQueries();
+    if (keepPairMatrix)
+      pairMatrix.assign(n * n, 0);
+
+    //Every chunk counts into its own slot; the slots are summed afterwards,
+    //so the totals do not depend on the number of threads
+    struct PairCounts {
+      int tableIndependent = 0;
+      int actionIndependent = 0;
+      int exclusive = 0;
+    };
+    auto bounds = splitPairRows(n, pairThreads > 1 ? pairThreads * 4 : 1);
+    std::vector<PairCounts> counts(bounds.size() - 1);
+    parallelFor(counts.size(), pairThreads, [&](size_t c) {
+      PairCounts local;
+      for (size_t i = bounds[c]; i < bounds[c + 1]; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+          unsigned char flags = 0;
+          if (graph.isTableIndependent(pairTables[i]->vertex, pairTables[j]->vertex)) {
+            local.tableIndependent++;
+            flags |= TableIndependent;
+          }
+          if (graph.isActionIndependent(pairTables[i]->vertex, pairTables[j]->vertex)) {
+            local.actionIndependent++;
+            flags |= ActionIndependent;
           }
-          for (auto u : secondAction.second->use) {
-            if (firstAction.second->def.find(u) != firstAction.second->def.end()) {
-              dependencies->push_back(Dependency(*t, curTable, DependencyType::DefUse, false, u));
-              graph->add_edge((*t)->vertex, curTable->vertex, u, Graphs::EdgeType::ACTION);
-            }
+          if (pairTables[i]->exclusiveWith(pairTables[j])) {
+            local.exclusive++;
+            flags |= Exclusive;
           }
+          if (keepPairMatrix)
+            pairMatrix[i * n + j] = pairMatrix[j * n + i] = flags;
         }
       }
+      counts[c] = local;
+    });
+
+    for (auto &c : counts) {
+      stat.numTableIndependentPair += c.tableIndependent;
+      stat.numActionIndependentPair += c.actionIndependent;
+      stat.numExclusivePair += c.exclusive;
     }
+  }
 
+  void ControlContext::findPipelineDepth() {
+    ScopedTimer timer(metrics, "findPipelineDepth");
+    auto paths = graph.longestPaths();
+    stat.depth = paths.depth;
+    stat.tableDepth = paths.tableDepth;
+    stat.levelWidths = paths.levelWidths;
+    stat.criticalTables.clear();
+    for (auto v : paths.criticalTables)
+      stat.criticalTables.push_back(graph.vertexName(v));
   }
 
-  void TableAnalyzer::findIndependentTables(Stat& stat) {
-    for(auto i = tableStack->begin(); i != tableStack->end(); ++i){
-      if (graph->isCondition((*i)->vertex))
-        continue;
+  void ControlContext::packIntoStages() {
+    ScopedTimer timer(metrics, "packStages");
+    std::vector<uint64_t> memory(graph.numVertices(), 0);
+    for (auto t : tableStack)
+      memory[t->vertex] = t->memory;
+    stagePlan = multip4::packStages(graph, memory, stageBudget);
+  }
 
-      stat.numTable++;
+  void ControlContext::writeResults(ResultWriter &results, const FieldInterner &fields) const {
+    results.writeStat(stat);
+    results.writeDepth(stat);
+    if (packStages)
+      results.writeStages(stat, stagePlan, graph);
+    if (results.wants(ResultWriter::Tables)) {
+      for (auto t : pairTables) {
+        results.writeTable(stat, t, fields);
+        if (packStages)
+          results.writePlacement(stat, t, stagePlan.stage[t->vertex]);
+      }
+    }
+    if (results.wants(ResultWriter::Dependencies)) {
+      for (auto &d : dependencies)
+        results.writeDependency(stat, d);
+    }
+    if (results.wants(ResultWriter::Pairs) && !pairMatrix.empty()) {
+      size_t n = pairTables.size();
+      for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+          unsigned char flags = pairMatrix[i * n + j];
+          results.writePair(stat, pairTables[i], pairTables[j], flags & TableIndependent,
+              flags & ActionIndependent, flags & Exclusive);
+        }
+      }
+    }
+  }
+
+  void ControlContext::writeAnalysis(std::ostream &out, const FieldInterner &fields) {
+    std::vector<cstring> strings;
+    std::unordered_map<cstring, uint32_t> stringIds;
+    auto intern = [&](cstring s) -> uint32_t {
+      auto it = stringIds.emplace(s, (uint32_t)strings.size());
+      if (it.second)
+        strings.push_back(s);
+      return it.first->second;
+    };
+
+    Mp4gHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, Mp4gMagic, sizeof(header.magic));
+    header.byteOrder = Mp4gByteOrder;
+    header.version = Mp4gVersion;
+    header.fileName = intern(stat.fileName);
+    header.controlName = intern(stat.pipelineName);
+    header.fingerprint[0] = fingerprint.lo;
+    header.fingerprint[1] = fingerprint.hi;
+
+    std::vector<Mp4gVertex> vertices;
+    for (Graphs::vertex_t v = 0; v < graph.numVertices(); v++)
+      vertices.push_back({intern(graph.vertexName(v)), (uint32_t)graph.vertexType(v)});
+
+    //Sets are numbered in the order they are stored: a table's keys, then
+    //the def and use of each of its actions
+    std::vector<const ExprSet*> sets;
+    std::vector<Mp4gTable> tables;
+    std::vector<Mp4gAction> actions;
+    for (auto t : pairTables) {
+      Mp4gTable table = {intern(t->name), t->vertex, (uint32_t)sets.size(),
+        (uint32_t)actions.size(), (uint32_t)t->actions.size(),
+        (uint32_t)std::min<uint64_t>(t->memory, UINT32_MAX)};
+      sets.push_back(&t->keys);
+      for (auto a : t->actions) {
+        actions.push_back({intern(a.first), (uint32_t)sets.size(), (uint32_t)sets.size() + 1, 0,
+            {a.second->fingerprint.lo, a.second->fingerprint.hi}});
+        sets.push_back(&a.second->def);
+        sets.push_back(&a.second->use);
+      }
+      tables.push_back(table);
+    }
+
+    std::vector<uint32_t> fieldNames;
+    for (size_t f = 0; f < fields.size(); f++)
+      fieldNames.push_back(intern(fields.name(f)));
 
-      for(auto j = (i+1); j != tableStack->end(); ++j) {
-        if (graph->isCondition((*j)->vertex))
+    std::vector<Mp4gDependency> edges;
+    for (auto &d : dependencies) {
+      Mp4gDependency edge = {d.firstTable->vertex, d.secondTable->vertex,
+        (uint32_t)fields.find(d.dataName), (uint8_t)d.type, (uint8_t)d.kind, {0, 0}};
+      edges.push_back(edge);
+    }
+
+    header.setWords = (fields.size() + 63) / 64;
+    std::vector<uint64_t> setWords(sets.size() * header.setWords, 0);
+    for (size_t i = 0; i < sets.size(); i++) {
+      for (auto f : *sets[i])
+        setWords[i * header.setWords + f / 64] |= uint64_t(1) << (f % 64);
+    }
+
+    size_t n = pairTables.size();
+    header.reachWords = (n + 63) / 64;
+    std::vector<uint64_t> reach(2 * n * header.reachWords, 0);
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        if (i == j)
           continue;
+        auto bit = uint64_t(1) << (j % 64);
+        if (graph.reachable(pairTables[i]->vertex, pairTables[j]->vertex, false))
+          reach[i * header.reachWords + j / 64] |= bit;
+        if (graph.reachable(pairTables[i]->vertex, pairTables[j]->vertex, true))
+          reach[(n + i) * header.reachWords + j / 64] |= bit;
+      }
+    }
+
+    std::string image(sizeof(header), '\0');
+    auto section = [&image](const void *data, size_t bytes) -> uint64_t {
+      image.resize((image.size() + 7) & ~size_t(7), '\0');
+      uint64_t offset = image.size();
+      image.append(static_cast<const char*>(data), bytes);
+      return offset;
+    };
 
-        if(graph->isTableIndependent((*i)->vertex, (*j)->vertex)) {
-          stat.numTableIndependentPair++;
-          /*
-          std::cout << "Table " << (*i)->name << " and "
-            "Table " << (*j)->name << " are table-independent." << std:: endl;
-          */
+    std::vector<uint32_t> stringOffsets;
+    uint32_t textOffset = (strings.size() + 1) * sizeof(uint32_t);
+    std::string text;
+    for (auto s : strings) {
+      stringOffsets.push_back(textOffset + text.size());
+      text.append(s.c_str(), s.size() + 1);
+    }
+    stringOffsets.push_back(textOffset + text.size());
+    header.numStrings = strings.size();
+    header.stringsOffset = section(stringOffsets.data(), stringOffsets.size() * sizeof(uint32_t));
+    image += text;
+
+    header.numVertices = vertices.size();
+    header.verticesOffset = section(vertices.data(), vertices.size() * sizeof(Mp4gVertex));
+    header.numTables = tables.size();
+    header.tablesOffset = section(tables.data(), tables.size() * sizeof(Mp4gTable));
+    header.numActions = actions.size();
+    header.actionsOffset = section(actions.data(), actions.size() * sizeof(Mp4gAction));
+    header.numFields = fieldNames.size();
+    header.fieldsOffset = section(fieldNames.data(), fieldNames.size() * sizeof(uint32_t));
+    header.numDependencies = edges.size();
+    header.dependenciesOffset = section(edges.data(), edges.size() * sizeof(Mp4gDependency));
+    header.setsOffset = section(setWords.data(), setWords.size() * sizeof(uint64_t));
+    header.reachOffset = section(reach.data(), reach.size() * sizeof(uint64_t));
+
+    //Index of every table's first (id, arm) pair, then the pairs
+    std::vector<uint32_t> branches(n + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+      branches[i] = (branches.size() - n - 1) / 2;
+      for (auto &b : pairTables[i]->branches) {
+        branches.push_back(b.first);
+        branches.push_back(b.second);
+      }
+    }
+    branches[n] = (branches.size() - n - 1) / 2;
+    header.branchesOffset = section(branches.data(), branches.size() * sizeof(uint32_t));
+    header.fileSize = image.size();
+    memcpy(&image[0], &header, sizeof(header));
+    out.write(image.data(), image.size());
+  }
+
+  bool ControlContext::restore(const MappedAnalysis &previous, FieldInterner &fields) {
+    //MappedAnalysis::open has checked every string, set, vertex and field
+    //index; check the values it leaves to us before building anything, so a
+    //damaged image falls back to a walk
+    uint32_t numVertices = previous.numVertices();
+    uint32_t numFields = previous.numFields();
+    for (uint32_t v = 0; v < numVertices; v++) {
+      if (previous.vertexType(v) > (uint32_t)Graphs::VertexType::CONDITION)
+        return false;
+    }
+    //Each table must have a vertex of its own
+    std::vector<bool> tableVertices(numVertices, false);
+    for (uint32_t t = 0; t < previous.numTables(); t++) {
+      if (tableVertices[previous.tableVertex(t)])
+        return false;
+      tableVertices[previous.tableVertex(t)] = true;
+    }
+    for (uint32_t i = 0; i < previous.numDependencies(); i++) {
+      auto &d = previous.dependency(i);
+      if (d.type > DependencyType::DefDef || d.kind > (uint8_t)Graphs::EdgeType::STATEFUL)
+        return false;
+    }
+
+    std::vector<int> fieldIds;
+    for (uint32_t f = 0; f < numFields; f++)
+      fieldIds.push_back(fields.intern(previous.fieldName(f)));
+
+    std::vector<Table*> vertexTables;
+    for (uint32_t v = 0; v < numVertices; v++) {
+      auto t = arena.make<Table>();
+      t->name = previous.vertexName(v);
+      t->vertex = graph.add_vertex(t->name, (Graphs::VertexType)previous.vertexType(v));
+      vertexTables.push_back(t);
+    }
+
+    //The tables in their stored order, then the conditions, which
+    //findIndependentTables skips
+    for (uint32_t t = 0; t < previous.numTables(); t++) {
+      auto table = vertexTables[previous.tableVertex(t)];
+      table->memory = previous.tableMemory(t);
+      for (uint32_t b = 0; b < previous.numBranches(t); b++) {
+        uint32_t id, arm;
+        previous.branch(t, b, id, arm);
+        table->branches.push_back({id, arm});
+      }
+      for (uint32_t f = 0; f < numFields; f++) {
+        if (previous.keyUses(t, f))
+          table->keys.insert(fieldIds[f]);
+      }
+      for (uint32_t a = 0; a < previous.numActions(t); a++) {
+        cstring name = previous.actionName(t, a);
+        auto action = actionMap[name];
+        if (action == nullptr) {
+          action = arena.make<Action>();
+          for (uint32_t f = 0; f < numFields; f++) {
+            if (previous.actionDefines(t, a, f))
+              action->def.insert(fieldIds[f]);
+            if (previous.actionUses(t, a, f))
+              action->use.insert(fieldIds[f]);
+          }
+          action->fingerprint.lo = previous.actionFingerprint(t, a)[0];
+          action->fingerprint.hi = previous.actionFingerprint(t, a)[1];
+          actionMap[name] = action;
+        }
+        table->actions[name] = action;
+      }
+      table->onStack = true;
+      tableStack.push_back(table);
+    }
+    for (auto t : vertexTables) {
+      if (!t->onStack && graph.isCondition(t->vertex)) {
+        t->onStack = true;
+        tableStack.push_back(t);
+      }
+    }
+
+    for (uint32_t i = 0; i < previous.numDependencies(); i++) {
+      auto &d = previous.dependency(i);
+      auto type = (DependencyType)d.type;
+      auto kind = (Graphs::EdgeType)d.kind;
+      dependencies.push_back(Dependency(vertexTables[d.from], vertexTables[d.to], type,
+            kind, fields.name(fieldIds[d.field])));
+      graph.add_edge(d.from, d.to, fieldIds[d.field], kind, type);
+    }
+
+    //Presets go in last; adding edges drops them
+    for (uint32_t t = 0; t < previous.numTables(); t++) {
+      std::vector<Graphs::vertex_t> all, tableOnly;
+      for (uint32_t u = 0; u < previous.numTables(); u++) {
+        if (previous.reaches(false, t, u))
+          all.push_back(previous.tableVertex(u));
+        if (previous.reaches(true, t, u))
+          tableOnly.push_back(previous.tableVertex(u));
+      }
+      graph.presetReachability(previous.tableVertex(t), std::move(all), std::move(tableOnly));
+    }
+    rowsReused = previous.numTables();
+    restored = true;
+    return true;
+  }
+
+  // A table's row can be copied when no table reachable from it, itself
+  // included, has gained, lost or changed an outgoing dependency: the set of
+  // tables it reaches is then the same as in the stored image. Conditions
+  // have no outgoing dependencies and are not stored, so their rows are
+  // always computed.
+  size_t ControlContext::reuseReachability(const MappedAnalysis &previous) {
+    size_t n = graph.numVertices();
+
+    //Outgoing dependencies of every vertex, by target name, as sorted text
+    std::vector<std::vector<std::string>> edges(n);
+    std::vector<std::vector<Graphs::vertex_t>> predecessors(n);
+    for (auto &d : dependencies) {
+      edges[d.firstTable->vertex].push_back(std::string(d.secondTable->name.c_str()) + "\t" +
+          d.dataName.c_str() + "\t" + std::to_string(d.type) + "\t" +
+          std::to_string((int)d.kind));
+      predecessors[d.secondTable->vertex].push_back(d.firstTable->vertex);
+    }
+    std::vector<std::vector<std::string>> oldEdges(previous.numVertices());
+    for (uint32_t i = 0; i < previous.numDependencies(); i++) {
+      auto &d = previous.dependency(i);
+      if (d.from >= oldEdges.size() || d.to >= oldEdges.size() || d.field >= previous.numFields())
+        return 0;
+      oldEdges[d.from].push_back(std::string(previous.vertexName(d.to)) + "\t" +
+          previous.fieldName(d.field) + "\t" + std::to_string(d.type) + "\t" +
+          std::to_string(d.kind));
+    }
+
+    std::unordered_map<cstring, int> oldTables;
+    for (uint32_t t = 0; t < previous.numTables(); t++) {
+      if (previous.tableVertex(t) >= oldEdges.size())
+        return 0;
+      //Names that are not unique cannot be matched
+      auto it = oldTables.emplace(previous.tableName(t), t);
+      if (!it.second)
+        it.first->second = -1;
+    }
+    //Runs before findIndependentTables has filled in pairTables
+    std::vector<Table*> tables;
+    for (auto t : tableStack) {
+      if (!graph.isCondition(t->vertex))
+        tables.push_back(t);
+    }
+    std::unordered_map<cstring, int> newTables;
+    for (auto t : tables) {
+      auto it = newTables.emplace(t->name, (int)t->vertex);
+      if (!it.second)
+        it.first->second = -1;
+    }
+
+    //Mark the changed vertices, then everything that reaches them
+    std::vector<bool> affected(n, false);
+    std::vector<Graphs::vertex_t> queue;
+    for (Graphs::vertex_t v = 0; v < n; v++) {
+      bool changed;
+      if (graph.isCondition(v)) {
+        changed = !edges[v].empty();
+      } else {
+        auto old = oldTables.find(graph.vertexName(v));
+        changed = old == oldTables.end() || old->second < 0 ||
+          newTables.at(graph.vertexName(v)) < 0;
+        if (!changed) {
+          auto &oldOut = oldEdges[previous.tableVertex(old->second)];
+          std::sort(edges[v].begin(), edges[v].end());
+          std::sort(oldOut.begin(), oldOut.end());
+          changed = edges[v] != oldOut;
         }
-        if(graph->isActionIndependent((*i)->vertex, (*j)->vertex)) {
-          stat.numActionIndependentPair++;
-          /*
-          std::cout << "Table " << (*i)->name << " and "
-            "Table " << (*j)->name << " are action-independent." << std:: endl;
-          */
+      }
+      if (changed) {
+        affected[v] = true;
+        queue.push_back(v);
+      }
+    }
+    for (size_t head = 0; head < queue.size(); head++) {
+      for (auto p : predecessors[queue[head]]) {
+        if (!affected[p]) {
+          affected[p] = true;
+          queue.push_back(p);
         }
       }
     }
+
+    size_t reused = 0;
+    for (auto t : tables) {
+      if (affected[t->vertex])
+        continue;
+      int row = oldTables.at(t->name);
+      std::vector<Graphs::vertex_t> all, tableOnly;
+      bool matched = true;
+      for (uint32_t u = 0; u < previous.numTables() && matched; u++) {
+        if (!previous.reaches(false, row, u))
+          continue;
+        //Every table reachable from an unaffected one is unaffected as well,
+        //so it has a unique match
+        auto to = newTables.find(previous.tableName(u));
+        matched = to != newTables.end() && to->second >= 0;
+        if (!matched)
+          break;
+        all.push_back(to->second);
+        if (previous.reaches(true, row, u))
+          tableOnly.push_back(to->second);
+      }
+      if (!matched)
+        continue;
+      graph.presetReachability(t->vertex, std::move(all), std::move(tableOnly));
+      reused++;
+    }
+    rowsReused = reused;
+    return reused;
   }
 
-  bool TableAnalyzer::preorder(const IR::PackageBlock *block) {
-    for (auto it : block->constantValue) {
-      if(it.second->is<IR::ControlBlock>()) {
-        auto name = it.second->to<IR::ControlBlock>()->container->name;
-        //std::cout << "\nAnalyzing top-level control " << name << std::endl;
-        visit(it.second->getNode());
-        clearCurrentActionMap();
-        
-        /*
-        std::cout << "Printing Tables..." << std::endl;
-        for(auto i = tableStack->begin(); i != tableStack->end(); ++i) 
-          (*i)->print();
-        std::cout << "Printing Dependencies..." << std::endl;
-        for(auto i = dependencies->begin(); i != dependencies->end(); ++i) 
-          (*i).print();
-        */
+  std::vector<cstring> ControlContext::changedActions(const MappedAnalysis &previous) const {
+    std::vector<cstring> changed;
+    std::set<cstring> seen;
+    for (auto t : tableStack) {
+      if (graph.isCondition(t->vertex))
+        continue;
+      int old = previous.findTable(t->name);
+      for (auto a : t->actions) {
+        if (!seen.insert(a.first).second)
+          continue;
+        bool same = false;
+        for (uint32_t i = 0; old >= 0 && i < previous.numActions(old) && !same; i++) {
+          same = a.first == previous.actionName(old, i) &&
+            previous.actionFingerprint(old, i)[0] == a.second->fingerprint.lo &&
+            previous.actionFingerprint(old, i)[1] == a.second->fingerprint.hi;
+        }
+        if (!same)
+          changed.push_back(stat.pipelineName + "." + a.first);
+      }
+    }
+    return changed;
+  }
 
-        Stat stat(name, fileName);
-        findIndependentTables(stat);
-        stat.print();
+  // One row and column per table: X = in exclusive branches, T =
+  // table-independent, A = only match-independent, - = dependent.
+  void ControlContext::writePairMatrix(std::ostream &out) const {
+    size_t n = pairTables.size();
+    out << "table";
+    for (auto t : pairTables)
+      out << "," << t->name;
+    out << "\n";
+    for (size_t i = 0; i < n; i++) {
+      out << pairTables[i]->name;
+      for (size_t j = 0; j < n; j++) {
+        unsigned char flags = pairMatrix.empty() ? 0 : pairMatrix[i * n + j];
+        out << ",";
+        if (i == j)
+          continue;
+        if (flags & Exclusive)
+          out << "X";
+        else if (flags & TableIndependent)
+          out << "T";
+        else if (flags & ActionIndependent)
+          out << "A";
+        else
+          out << "-";
+      }
+      out << "\n";
+    }
+  }
+
+  cstring TableAnalyzer::controlOutputPath(cstring dir, const ControlContext *c,
+      cstring extension) const {
+    auto file = Util::PathName(options.file).getFilename();
+    return dir + "/" + file + "." + c->stat.pipelineName + extension;
+  }
 
-        tableStack = new TableStack();
-        dependencies = new Dependencies();
-        graph = new Graphs();
+  cstring TableAnalyzer::writeAnalysisFile(ControlContext *c, cstring dir) {
+    auto path = controlOutputPath(dir, c, ".mp4g");
+    auto analysisOut = openFile(path, false);
+    if (analysisOut == nullptr)
+      ::error("Failed to open file %1%", path);
+    else
+      c->writeAnalysis(*analysisOut, fields);
+    delete analysisOut;
+    return path;
+  }
+
+  void TableAnalyzer::restoreOrWalk(const IR::ControlBlock *block) {
+    control->fingerprint = fingerprintControl(block->container, refMap);
+    if (options.firstApplyOnly)
+      control->fingerprint.add((uint64_t)true);
+    //A missing or unreadable image just means a full walk
+    MappedAnalysis previous;
+    bool havePrevious = previous.open(controlOutputPath(options.incrementalDir, control, ".mp4g"));
+    if (havePrevious && previous.fingerprint()[0] == control->fingerprint.lo &&
+        previous.fingerprint()[1] == control->fingerprint.hi &&
+        control->restore(previous, fields)) {
+      if (incremental != nullptr)
+        incremental->reusedControls.push_back(control->stat.pipelineName);
+      return;
+    }
+
+    curAction = control->arena.make<Action>();
+    curTable = control->arena.make<Table>();
+    visit(block);
+    if (incremental != nullptr)
+      incremental->reanalyzedControls.push_back(control->stat.pipelineName);
+    if (!havePrevious)
+      return;
+    control->reuseReachability(previous);
+    if (incremental != nullptr) {
+      for (auto a : control->changedActions(previous))
+        incremental->changedActions.push_back(a);
+    }
+  }
+
+  bool TableAnalyzer::preorder(const IR::PackageBlock *block) {
+    //The IR walk stays serial; only the per-control work after it is
+    //spread over threads.
+    std::vector<ControlContext*> controls;
+    {
+      ScopedTimer timer(metrics, "buildGraphs");
+      for (auto it : block->constantValue) {
+        if(it.second->is<IR::ControlBlock>()) {
+          auto name = it.second->to<IR::ControlBlock>()->container->name;
+          //std::cout << "\nAnalyzing top-level control " << name << std::endl;
+          control = new ControlContext(name, options,
+              metrics != nullptr ? metrics->addControl(name) : nullptr);
+          controls.push_back(control);
+          ScopedTimer controlTimer(control->metrics, "buildGraphs");
+          if (options.incrementalDir != nullptr) {
+            restoreOrWalk(it.second->to<IR::ControlBlock>());
+            continue;
+          }
+          curAction = control->arena.make<Action>();
+          curTable = control->arena.make<Table>();
+          visit(it.second->getNode());
+        }
       }
+      control = nullptr;
+      curAction = nullptr;
+      curTable = nullptr;
     }
 
+    {
+      ScopedTimer timer(metrics, "findIndependentTables");
+      parallelFor(controls.size(), options.controlThreads,
+          [&controls](size_t i) {
+            controls[i]->findIndependentTables();
+            if (controls[i]->packStages)
+              controls[i]->packIntoStages();
+          });
+    }
+
+    for (auto c : controls) {
+      //Records sent to stdout replace the plain stat lines there
+      if (results == nullptr || options.resultsFile != "-")
+        c->stat.print(out);
+      if (results != nullptr)
+        c->writeResults(*results, fields);
+      if (options.pairMatrixDir != nullptr) {
+        auto path = controlOutputPath(options.pairMatrixDir, c, ".csv");
+        auto matrixOut = openFile(path, false);
+        if (matrixOut == nullptr)
+          ::error("Failed to open file %1%", path);
+        else
+          c->writePairMatrix(*matrixOut);
+        delete matrixOut;
+        writtenFiles.push_back(path);
+      }
+      if (options.analysisDir != nullptr)
+        writtenFiles.push_back(writeAnalysisFile(c, options.analysisDir));
+      //Restored controls already have their image in the state
+      if (options.incrementalDir != nullptr && !c->restored)
+        writeAnalysisFile(c, options.incrementalDir);
+      if (incremental != nullptr) {
+        incremental->rowsReused += c->rowsReused;
+        incremental->rowsComputed += c->graph.reachabilityRowsComputed();
+      }
+      if (options.graphDir != nullptr) {
+        ScopedTimer timer(metrics, "writeGraphs");
+        ScopedTimer controlTimer(c->metrics, "writeGraphs");
+        auto filter = options.graphEdges == "table" ? Graphs::EdgeFilter::TABLE
+          : options.graphEdges == "action" ? Graphs::EdgeFilter::ACTION
+          : options.graphEdges == "stateful" ? Graphs::EdgeFilter::STATEFUL
+          : Graphs::EdgeFilter::ALL;
+        auto path = controlOutputPath(options.graphDir, c, "");
+        c->graph.writeGraphToFile(path, fields, filter);
+        writtenFiles.push_back(path + ".dot");
+      }
+      c->recordMetrics();
+      LOG1("Control " << c->stat.pipelineName << ": peak analysis memory "
+          << c->analysisBytes() << " bytes");
+      delete c;
+    }
 
     return false;
   }
@@ -279,35 +1062,115 @@ namespace multip4 {
     return false;
   }
 
+  void TableAnalyzer::addTable(Table *table, Graphs::VertexType type) {
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::AddTable, table, type, nullptr});
+    table->branches = branchPath;
+    table->vertex = control->graph.add_vertex(table->name, type);
+    //Replayed tables are added while curTable is the one being built
+    auto building = curTable;
+    curTable = table;
+    buildDependenceGraph();
+    control->pushTable(table);
+    curTable = table == building ? control->arena.make<Table>() : building;
+  }
+
+  void TableAnalyzer::enterBranch() {
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::EnterBranch, nullptr,
+          Graphs::VertexType::TABLE, nullptr});
+    //Branches only ever append to the tableStack, so the tables before the
+    //branch are still its prefix afterwards
+    branchFrames.push_back({control->tableStack.size(), TableStack()});
+    branchPath.push_back({numBranches++, 0});
+  }
+
+  void TableAnalyzer::endArm() {
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::EndArm, nullptr,
+          Graphs::VertexType::TABLE, nullptr});
+    auto &frame = branchFrames.back();
+    frame.arms.insert(frame.arms.end(), control->tableStack.begin() + frame.size,
+        control->tableStack.end());
+    control->popTables(frame.size);
+    branchPath.back().second++;
+  }
+
+  void TableAnalyzer::leaveBranch() {
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::LeaveBranch, nullptr,
+          Graphs::VertexType::TABLE, nullptr});
+    for (auto t : branchFrames.back().arms)
+      control->pushTable(t);
+    branchFrames.pop_back();
+    branchPath.pop_back();
+  }
+
+  void TableAnalyzer::applyControl(const IR::P4Control *sub) {
+    auto found = control->controlSummaries.find(sub);
+    if (found != control->controlSummaries.end()) {
+      if (options.firstApplyOnly)
+        return;
+      control->summaryHits++;
+      replay(found->second);
+      return;
+    }
+    auto &summary = control->controlSummaries[sub];
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::Apply, nullptr,
+          Graphs::VertexType::TABLE, &summary});
+    recording.push_back(&summary);
+    visit(sub);
+    recording.pop_back();
+  }
+
+  void TableAnalyzer::replay(const ControlSummary &summary) {
+    if (!recording.empty())
+      recording.back()->steps.push_back({ControlSummary::Step::Apply, nullptr,
+          Graphs::VertexType::TABLE, &summary});
+    //The steps go to the summary being recorded as the single Apply above
+    auto outer = std::move(recording);
+    recording.clear();
+    for (auto &step : summary.steps) {
+      switch (step.kind) {
+        case ControlSummary::Step::AddTable: {
+          //A new instance of the table: same keys and actions, its own
+          //vertex and dependencies
+          auto table = control->arena.make<Table>();
+          table->name = step.table->name;
+          table->keys = step.table->keys;
+          table->actions = step.table->actions;
+          table->memory = step.table->memory;
+          addTable(table, step.type);
+          break;
+        }
+        case ControlSummary::Step::EnterBranch: enterBranch(); break;
+        case ControlSummary::Step::EndArm: endArm(); break;
+        case ControlSummary::Step::LeaveBranch: leaveBranch(); break;
+        case ControlSummary::Step::Apply: replay(*step.control); break;
+      }
+    }
+    recording = std::move(outer);
+  }
+
   bool TableAnalyzer::preorder(const IR::IfStatement *statement) {
     //Insert if statement as a table
     std::ostringstream _stream;
     statement->condition->dbprint(_stream);
     curTable->name = _stream.str();
     curTable->keys = findId(statement->condition);
-    curTable->vertex = graph->add_vertex(curTable->name, Graphs::VertexType::CONDITION);
-    buildDependenceGraph();
-    tableStack->push_back(curTable);
-    curTable = new Table();
-
-    //Copy the current tableStack
-    int size = (int)tableStack->size();
-    TableStack *savedTableStack = new TableStack();
-    savedTableStack->resize(size);
-    std::copy(tableStack->begin(),tableStack->end(),savedTableStack->begin());
-    visit(statement->ifTrue);
+    addTable(curTable, Graphs::VertexType::CONDITION);
 
-    //Restore tableStack
+    enterBranch();
+    visit(statement->ifTrue);
     if(statement->ifFalse != nullptr) {
-      if (*savedTableStack != *tableStack) {
-        TableStack *tmp = tableStack;
-        tableStack = savedTableStack;
-        savedTableStack = tmp;
-      }
+      //Set the true branch aside and analyze the false branch against the
+      //tables before the if
+      endArm();
       visit(statement->ifFalse);
-      //Merge tableStack of true and false
-      tableStack->insert(tableStack->end(), savedTableStack->begin()+size, savedTableStack->end());
     }
+    //Merge tableStack of true and false
+    leaveBranch();
 
     return false;
   }
@@ -318,46 +1181,96 @@ namespace multip4 {
       visit(tbl);
     }
 
+    //Like the branches of an if, every case is analyzed against the tables
+    //before the switch only, and all of them are merged afterwards. Labels
+    //without a statement fall through to the next case's arm.
+    enterBranch();
     for (auto scase : statement->cases) {
       if(scase->statement != nullptr) {
         visit(scase->statement);
+        endArm();
       }
       if(scase->label->is<IR::DefaultExpression>()) {
         break;
       }
     }
+    leaveBranch();
 
     return false;
   }
 
+  // How a method of an extern that keeps state from one packet to the next
+  // accesses the state of its instance. Registers are read and written
+  // apart; counting and metering read and update it in one step.
+  static void stateAccess(cstring type, cstring method, bool &reads, bool &writes) {
+    static const char *names[] = {
+      "register", "counter", "meter", "direct_counter", "direct_meter",
+      "Register", "Counter", "Meter", "DirectCounter", "DirectMeter"
+    };
+    reads = writes = false;
+    for (auto name : names) {
+      if (type == name) {
+        bool isRegister = type == "register" || type == "Register";
+        reads = !(isRegister && method == "write");
+        writes = !(isRegister && method == "read");
+        return;
+      }
+    }
+  }
+
   void TableAnalyzer::visitExterns(const P4::MethodInstance *instance) {
     auto args = instance->expr->arguments;
-    auto params = instance->getActualParameters();
-    ExprSet inExprs = {};
-    ExprSet outExprs = {};
-    
-    //std::cout << "    Extern: " << instance->expr->method << std::endl;
-    if (args->size() != params->size()) {
-      ::error("ERROR: the number of args / params does not match");
-      return;
+    auto function = instance->to<P4::ExternFunction>();
+    auto method = instance->to<P4::ExternMethod>();
+    ExprSet inExprs;
+    ExprSet outExprs;
+
+    //The parameter directions only depend on the callee, so they are looked
+    //up once per callee and number of arguments
+    auto key = std::make_pair(function != nullptr ? function->method : method->method,
+        args->size());
+    auto found = externSummaries.find(key);
+    if (found == externSummaries.end()) {
+      auto params = instance->getActualParameters();
+      //std::cout << "    Extern: " << instance->expr->method << std::endl;
+      if (args->size() != params->size()) {
+        ::error("ERROR: the number of args / params does not match");
+        return;
+      }
+      ExternSummary summary;
+      for (unsigned i = 0; i < args->size(); i++)
+        summary.out.push_back(params->getParameter(i)->hasOut());
+      if (method != nullptr)
+        stateAccess(method->originalExternType->name, method->method->name, summary.readsState,
+            summary.writesState);
+      found = externSummaries.emplace(key, summary).first;
     }
+    auto &summary = found->second;
 
     for (unsigned i = 0; i < args->size(); i++) {
       auto a = (*args)[i];
-      auto p = params->getParameter(i);
-      if (p->hasOut()){
+      if (summary.out[i]){
         //std::cout << "      OUT: " << a << std::endl;
-        outExprs = unionExprSet(findId(a), outExprs);
+        collectIds(a, outExprs);
       } else {
         //std::cout << "      IN:  " << a << std::endl;
-        inExprs = unionExprSet(findId(a), inExprs);
+        collectIds(a, inExprs);
       }
     }
 
     if (curAction->action != nullptr) {
-      curAction->def = unionExprSet(curAction->def, outExprs);
-      curAction->use = unionExprSet(curAction->use,
-          subtractExprSet(inExprs, curAction->def));
+      curAction->def |= outExprs;
+      curAction->use.insertAllExcept(inExprs, curAction->def);
+      //The state of a register, counter or meter instance is a field of
+      //its own
+      if (summary.readsState || summary.writesState) {
+        int state = fields.intern(std::string("$") + method->object->externalName().c_str());
+        statefulFields.insert(state);
+        if (summary.readsState && !curAction->def.contains(state))
+          curAction->use.insert(state);
+        if (summary.writesState)
+          curAction->def.insert(state);
+      }
     }
   }
 
@@ -379,7 +1292,7 @@ namespace multip4 {
         if (type->is<IR::Type_Name>()) {
           auto tn = type->to<IR::Type_Name>();
           auto decl = refMap->getDeclaration(tn->path, true);
-          visit(decl->to<IR::P4Control>());
+          applyControl(decl->to<IR::P4Control>());
         }   
       } else {
           BUG("Unsupported apply method: %1%", instance);
@@ -396,13 +1309,16 @@ namespace multip4 {
 
   bool TableAnalyzer::preorder(const IR::AssignmentStatement *statement) {
     if (curAction->action != nullptr) {
-      if (statement->left->is<IR::Member>()) {
-        curAction->def = unionExprSet(curAction->def, {statement->left->toString()});
-      } else if (statement->left->is<IR::AttribLocal>()) {
-        curAction->def = unionExprSet(curAction->def, {statement->left->toString()});
-      }
-      curAction->use = unionExprSet(curAction->use, 
-          subtractExprSet(findId(statement->right), curAction->def));
+      //A slice or stack element writes only its bits; a header copy writes
+      //the whole header, which overlaps each of its fields
+      int id = fieldId(statement->left);
+      if (id >= 0)
+        curAction->def.insert(id);
+      std::vector<const IR::Expression*> indices;
+      indexExpressions(statement->left, indices);
+      for (auto index : indices)
+        curAction->use.insertAllExcept(findId(index), curAction->def);
+      curAction->use.insertAllExcept(findId(statement->right), curAction->def);
     }
     return false;
   }
@@ -421,14 +1337,21 @@ namespace multip4 {
     curTable->name = table->controlPlaneName();
 
     //Key
+    uint64_t keyBits = 0;
     const auto keys = table->getKey();
     if (keys != nullptr) {
       if (keys->keyElements.empty() == false) {
         //std::cout << "Keys:" << std::endl;
-        for (const auto key : keys->keyElements)
+        for (const auto key : keys->keyElements) {
           visit(key);
+          if (auto type = typeMap->getType(key->expression))
+            keyBits += type->width_bits();
+        }
       }
     }
+    auto size = table->getSizeProperty();
+    curTable->memory = (size != nullptr ? size->asUnsigned() : DefaultTableSize) *
+      ((keyBits + 7) / 8);
 
     //Action
     const auto actions = table->getActionList();
@@ -441,10 +1364,7 @@ namespace multip4 {
     }
 
     //curTable->print();
-    curTable->vertex = graph->add_vertex(curTable->name, Graphs::VertexType::TABLE);
-    buildDependenceGraph();
-    tableStack->push_back(curTable);
-    curTable = new Table();
+    addTable(curTable, Graphs::VertexType::TABLE);
     return false;
   }
 
@@ -452,16 +1372,27 @@ namespace multip4 {
     auto a = refMap->getDeclaration(action->getPath(), true)->to<IR::P4Action>();
     //std::cout << "  ActionListElement: " << a->toString() << std::endl;
     
-    if ((*curActionMap)[a->toString()] != nullptr) {
-      curTable->actions[a->toString()] = (*curActionMap)[a->toString()];
+    if (control->actionMap[a->toString()] != nullptr) {
+      curTable->actions[a->toString()] = control->actionMap[a->toString()];
     }
     return false;
   }
 
   bool TableAnalyzer::preorder(const IR::P4Action *action) {
     //std::cout << "  P4Action: " << action->toString() << std::endl;
+    //The def/use of an action does not depend on where it is used, so every
+    //control and sub-control instance after the first copies it
+    auto summary = actionSummaries.find(action);
+    if (summary != actionSummaries.end()) {
+      *curAction = summary->second;
+      saveCurrentAction();
+      return false;
+    }
     setCurrentAction(action);
+    if (options.incrementalDir != nullptr)
+      curAction->fingerprint = fingerprintNode(action);
     visit(action->body);
+    actionSummaries.emplace(action, *curAction);
     saveCurrentAction();
     return false;
   }
@@ -469,7 +1400,8 @@ namespace multip4 {
   bool TableAnalyzer::preorder(const IR::KeyElement *key) {
     if (key->expression != nullptr) {
       //std::cout << "  Key: " << key->expression->toString() << std::endl;
-      curTable->keys.insert(key->expression->toString());
+      int id = fieldId(key->expression);
+      curTable->keys.insert(id >= 0 ? id : fields.intern(key->expression->toString()));
     }
     return false;
   }
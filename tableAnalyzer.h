@@ -5,11 +5,23 @@ Written by Seungbin Song
 #ifndef MULTIP4_TABLE_ANALYZER_H
 #define MULTIP4_TABLE_ANALYZER_H
 
+#include <map>
+#include <unordered_map>
+#include <vector>
+
 #include "ir/ir.h"
 #include "ir/visitor.h"
 #include "frontends/p4/methodInstance.h"
 
+#include "arena.h"
+#include "contentHash.h"
+#include "exprSet.h"
 #include "graphs.h"
+#include "incremental.h"
+#include "instrumentation.h"
+#include "multip4Options.h"
+#include "resultWriter.h"
+#include "stagePacker.h"
 
 namespace P4 {
   class ReferenceMap;
@@ -19,28 +31,59 @@ namespace P4 {
 
 namespace multip4 {
 
-  typedef std::set<cstring> ExprSet;
+  class MappedAnalysis;
 
   class Action {
     public:
       const IR::P4Action *action;
       ExprSet def;
       ExprSet use;
+      // Only computed for incremental runs
+      ContentHash fingerprint;
 
       Action();
-      void print();
+      void print(const FieldInterner &fields);
   };
 
   typedef std::map<cstring, Action*> ActionMap;
 
+  // The (branch, arm) of every if and switch a table is nested in,
+  // outermost first. Branch IDs are unique within a control.
+  typedef std::vector<std::pair<unsigned, unsigned>> BranchPath;
+
   class Table {
     public:
       cstring name;
       ExprSet keys;
       ActionMap actions;
       Graphs::vertex_t vertex;
+      BranchPath branches;
+      // Estimated match memory in bytes: entries times key width
+      uint64_t memory = 0;
+      // onStack: currently part of the tableStack (a table in a branch that
+      // has been set aside is not). indexed: its fields are in the
+      // ControlContext's field index.
+      bool onStack = false;
+      bool indexed = false;
 
-      void print();
+      void print(const FieldInterner &fields);
+      // Whether the two tables are in different arms of one if or switch,
+      // so that no packet is matched against both.
+      bool exclusiveWith(const Table *other) const;
+  };
+
+  // What walking a sub-control does to the control that applies it, in
+  // order: later apply sites replay these steps instead of walking it again.
+  struct ControlSummary {
+    struct Step {
+      enum Kind { AddTable, EnterBranch, EndArm, LeaveBranch, Apply } kind;
+      // AddTable: the table or condition as first built
+      const Table *table;
+      Graphs::VertexType type;
+      // Apply: a sub-control of the sub-control
+      const ControlSummary *control;
+    };
+    std::vector<Step> steps;
   };
 
   class Stat {
@@ -48,26 +91,35 @@ namespace multip4 {
       int numTable;
       int numTableIndependentPair;
       int numActionIndependentPair;
+      // Pairs in exclusive branches; they are also table-independent. Not
+      // part of the printed line.
+      int numExclusivePair;
+      // Tables on the longest dependency chain, on the longest chain of
+      // match dependencies, and at each level of the longest chains (see
+      // Graphs::longestPaths). Not part of the printed line.
+      int depth;
+      int tableDepth;
+      std::vector<unsigned> levelWidths;
+      std::vector<cstring> criticalTables;
       cstring pipelineName;
       cstring fileName;
 
       Stat(cstring name, cstring fname);
-      void print();
+      void print(std::ostream &out);
   };
 
-
-  typedef enum DependencyType { UseDef, DefUse, DefDef } DependencyType;
-
   class Dependency {
     public:
       Table* firstTable;
       Table* secondTable;
       DependencyType type;
-      bool isTableDependency;
+      // TABLE for a match dependency; STATEFUL when dataName is the state
+      // of an extern instance
+      Graphs::EdgeType kind;
       cstring dataName;
 
       Dependency(Table* _first, Table* _second, DependencyType _type, 
-          bool _isTableDependency, cstring _dataName);
+          Graphs::EdgeType _kind, cstring _dataName);
 
       void print();
   };
@@ -75,18 +127,129 @@ namespace multip4 {
   typedef std::vector<Table*> TableStack;
   typedef std::vector<Dependency> Dependencies;
 
+  struct FieldAccess {
+    Table *table;
+    const Action *action;
+  };
+
+  // Field ID -> every (table, action) that accesses the field.
+  typedef std::vector<std::vector<FieldAccess>> FieldIndex;
+
+  // Analysis state of one top-level control. The IR walk fills it in; after
+  // that nothing outside it is touched, so the contexts of different
+  // controls can be finished concurrently.
+  class ControlContext {
+    public:
+      // Owns the Table and Action objects of this control; they are all
+      // released together with the context.
+      Arena arena;
+      ActionMap actionMap;
+      TableStack tableStack;
+      Dependencies dependencies;
+      Graphs graph;
+      Stat stat;
+      unsigned pairThreads;
+      // Independence of every pair of the tables in pairTables, filled in by
+      // findIndependentTables when keepPairMatrix is set.
+      bool keepPairMatrix;
+      std::vector<Table*> pairTables;
+      std::vector<unsigned char> pairMatrix;
+
+      // Tables that define / use each field, filled in as tables are first
+      // pushed. Entries of tables that are not onStack are skipped.
+      FieldIndex defIndex;
+      FieldIndex useIndex;
+
+      // Per-control timers and counters, or null when they are not
+      // collected. findIdCalls is kept apart so the hot path only bumps an
+      // integer; recordMetrics copies it and the other counters over.
+      Metrics *metrics;
+      uint64_t findIdCalls = 0;
+
+      // Summary of every sub-control applied so far, and the number of
+      // apply sites that replayed one.
+      std::unordered_map<const IR::P4Control*, ControlSummary> controlSummaries;
+      uint64_t summaryHits = 0;
+
+      // Incremental runs: fingerprint of the control's IR, and whether the
+      // analysis was restored from the state rather than walked.
+      ContentHash fingerprint;
+      bool restored = false;
+      size_t rowsReused = 0;
+
+      // Stage assignment of the tables, filled in by packIntoStages when
+      // packStages is set.
+      bool packStages;
+      StageBudget stageBudget;
+      StagePlan stagePlan;
+
+      enum PairFlags : unsigned char {
+        TableIndependent = 1, ActionIndependent = 2, Exclusive = 4
+      };
+
+      ControlContext(cstring name, const Options &options, Metrics *metrics = nullptr);
+      void pushTable(Table *table);
+      // Takes every table above the first `size` ones off the tableStack.
+      void popTables(size_t size);
+      void findIndependentTables();
+      void findPipelineDepth();
+      void packIntoStages();
+      void writePairMatrix(std::ostream &out) const;
+      // Memory held by the analysis objects of this control: the arena, the
+      // heap parts of its tables and actions (action maps, wide field sets,
+      // branch paths), the stack, indexes, dependencies, graph, pair matrix
+      // and sub-control summaries. Map and hash nodes are estimated from
+      // their element size plus the usual node pointers. Nothing is freed
+      // before the context goes away, so this is also the peak.
+      size_t analysisBytes() const;
+      void recordMetrics() const;
+      void writeResults(ResultWriter &results, const FieldInterner &fields) const;
+      // Writes the .mp4g image of this control (see analysisFile.h).
+      void writeAnalysis(std::ostream &out, const FieldInterner &fields);
+      // Rebuilds the tables, dependencies, graph and table reachability of
+      // an unchanged control from its stored image. Returns false, leaving
+      // the context untouched, when the image is inconsistent.
+      bool restore(const MappedAnalysis &previous, FieldInterner &fields);
+      // After the walk of a changed control: presets the reachability rows
+      // of the tables from which only dependencies identical to those in
+      // the stored image can be reached. Returns the number of rows preset.
+      size_t reuseReachability(const MappedAnalysis &previous);
+      // control.action of every table action new since the stored image or
+      // with another fingerprint.
+      std::vector<cstring> changedActions(const MappedAnalysis &previous) const;
+  };
+
   class TableAnalyzer : public Inspector {
     public:
-      TableAnalyzer(P4::ReferenceMap *refMap, P4::TypeMap *typeMap, cstring file);
+      TableAnalyzer(P4::ReferenceMap *refMap, P4::TypeMap *typeMap, const Options &options,
+          std::ostream &out, Metrics *metrics = nullptr, ResultWriter *results = nullptr,
+          IncrementalResult *incremental = nullptr);
 
       void setCurrentAction(const IR::P4Action *action);
       void saveCurrentAction();
-      void clearCurrentActionMap();
       void buildDependenceGraph();
-      void findIndependentTables(Stat& stat);
+      void addDependency(const FieldAccess &from, DependencyType type, Graphs::EdgeType kind,
+          int field);
 
+      // Appends the name of the field, header or stack element expr refers
+      // to (see FieldInterner), or returns false when it is none.
+      bool appendFieldName(const IR::Expression *expr, std::string &name);
+      // Interned ID of that name, or -1.
+      int fieldId(const IR::Expression *expr);
       ExprSet findId(const IR::Expression *expr);
+      void collectIds(const IR::Expression *expr, ExprSet &ids);
       void visitExterns(const P4::MethodInstance *instance);
+
+      // Every change the walk makes to the tableStack and branchPath goes
+      // through these, so that it can be recorded and replayed. The arms of
+      // a branch are analyzed from the tables before it: endArm sets the
+      // tables of an arm aside and leaveBranch puts them all back.
+      void addTable(Table *table, Graphs::VertexType type);
+      void enterBranch();
+      void endArm();
+      void leaveBranch();
+      void applyControl(const IR::P4Control *sub);
+      void replay(const ControlSummary &summary);
       
       bool preorder(const IR::PackageBlock *block) override;
       bool preorder(const IR::ControlBlock *block) override;
@@ -103,15 +266,54 @@ namespace multip4 {
       bool preorder(const IR::P4Action *action) override;
       bool preorder(const IR::KeyElement *key) override;
 
+      // Paths of the files written for --pair-matrix, --analysis-dir and
+      // --graph-dir.
+      const std::vector<cstring>& outputFiles() const { return writtenFiles; }
+
     private:
+      cstring controlOutputPath(cstring dir, const ControlContext *c, cstring extension) const;
+      // Incremental runs: restores the current control from the state if its
+      // fingerprint is unchanged, else walks it and reuses what it can.
+      void restoreOrWalk(const IR::ControlBlock *block);
+      // Writes c's .mp4g image to dir and returns its path.
+      cstring writeAnalysisFile(ControlContext *c, cstring dir);
+
       P4::ReferenceMap *refMap; P4::TypeMap *typeMap;
-      cstring fileName;
+      const Options &options;
+      std::ostream &out;
+      Metrics *metrics;
+      ResultWriter *results;
+      IncrementalResult *incremental;
+      FieldInterner fields;
+      std::vector<const IR::Expression*> idStack;
       Action *curAction;
-      ActionMap *curActionMap;
       Table *curTable;
-      TableStack *tableStack;
-      Dependencies *dependencies;
-      Graphs *graph;
+      ControlContext *control;
+      // The branches enclosing the statement being walked
+      BranchPath branchPath;
+      unsigned numBranches = 0;
+      struct BranchFrame {
+        size_t size;
+        TableStack arms;
+      };
+      std::vector<BranchFrame> branchFrames;
+      // Summaries of the sub-controls being walked, innermost last
+      std::vector<ControlSummary*> recording;
+
+      // Def/use of every action, shared by all controls of the program
+      std::unordered_map<const IR::P4Action*, Action> actionSummaries;
+      // Parameter directions of an extern function or method for a number
+      // of arguments, and whether it reads and writes the state of the
+      // instance it is called on
+      struct ExternSummary {
+        std::vector<bool> out;
+        bool readsState = false;
+        bool writesState = false;
+      };
+      std::map<std::pair<const IR::Method*, size_t>, ExternSummary> externSummaries;
+      // The pseudo-fields that stand for the state of extern instances
+      ExprSet statefulFields;
+      std::vector<cstring> writtenFiles;
   };
 
 } //namespace multip4
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs p4c-multip4 on the programs in samples/ and compares its stat lines
+# with result-samples.txt. With -u, rewrites result-samples.txt instead,
+# and result-p4-16.txt and result-p4-16-summary.md as well when the p4c
+# samples are linked in p4samples/. Also checks that --serve rejects the
+# requests in server-requests.ndjson with the errors in
+# server-responses.ndjson.
+
+cd "$(dirname "$0")" || exit 1
+
+analyze() {
+  ./p4c-multip4 --batch "$1" -Ip4include
+}
+
+summarize() {
+  awk -F', ' '
+    { if ($3 > 0) pipelines++; tables += $3; tableIndependent += $4; matchIndependent += $5 }
+    END {
+      print "| # of files | # of non-empty pipelines | # of tables | # of table-independent pairs | # of match-independent pairs |"
+      print "|-----|----|-----|----|----|"
+      printf "| %d | %d | %d | %d | %d |\n", NR, pipelines, tables, tableIndependent, matchIndependent
+    }' "$1"
+}
+
+if [ "$1" = "-u" ]; then
+  analyze samples > result-samples.txt || exit 1
+  if [ -d p4samples ]; then
+    analyze p4samples > result-p4-16.txt
+    summarize result-p4-16.txt > result-p4-16-summary.md
+  fi
+  exit 0
+fi
+
+status=0
+analyze samples | diff -u result-samples.txt - || status=1
+./p4c-multip4 --serve - < server-requests.ndjson | diff -u server-responses.ndjson - || status=1
+exit $status